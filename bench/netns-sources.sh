@@ -0,0 +1,82 @@
+#!/bin/sh
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# Per-source rate limiting across network namespaces; needs root and iproute2.
+#
+# Serves one interface in each of two network namespaces, which both get
+# ifindex 2 as the first interface created in a fresh namespace. One of
+# them is flooded from a single source address, while the other one sees
+# a few solicitations from the same address. The flood must not
+# rate-limit the solicitations in the other namespace; exits with status 1
+# if it does.
+
+set -e
+
+dir=$(cd "$(dirname "$0")" && pwd)
+uradvd=$dir/../uradvd
+flood=$dir/rs-flood
+
+ns_a=uradvd-srcs-a.$$
+ns_b=uradvd-srcs-b.$$
+ns_ca=uradvd-srcs-ca.$$
+ns_cb=uradvd-srcs-cb.$$
+
+pid=
+stats=$(mktemp)
+
+cleanup() {
+	[ -n "$pid" ] && kill "$pid" 2>/dev/null || true
+	for ns in "$ns_a" "$ns_b" "$ns_ca" "$ns_cb"; do
+		ip netns del "$ns" 2>/dev/null || true
+	done
+	rm -f "$stats"
+}
+trap cleanup EXIT INT TERM
+
+for ns in "$ns_a" "$ns_b" "$ns_ca" "$ns_cb"; do
+	ip netns add "$ns"
+done
+ip -n "$ns_a" link add srcs0 type veth peer name srcs1 netns "$ns_ca"
+ip -n "$ns_b" link add srcs0 type veth peer name srcs1 netns "$ns_cb"
+ip -n "$ns_a" link set srcs0 up
+ip -n "$ns_b" link set srcs0 up
+ip -n "$ns_ca" link set srcs1 up
+ip -n "$ns_cb" link set srcs1 up
+
+a=$(ip -n "$ns_a" -o link show srcs0 | cut -d: -f1)
+b=$(ip -n "$ns_b" -o link show srcs0 | cut -d: -f1)
+if [ "$a" != "$b" ]; then
+	echo "ifindexes differ ($a, $b), can't test" >&2
+	exit 1
+fi
+
+# Wait for DAD of the link-local addresses to complete
+while ip -n "$ns_a" -6 addr show dev srcs0 | grep -q tentative || ip -n "$ns_b" -6 addr show dev srcs0 | grep -q tentative; do
+	sleep 0.1
+done
+
+"$uradvd" -i "$ns_a/srcs0" -a 2001:db8:a::/64 -i "$ns_b/srcs0" -a 2001:db8:b::/64 2>"$stats" &
+pid=$!
+sleep 1
+
+ip netns exec "$ns_ca" "$flood" -i srcs1 -r 200 -n 600 -s 1 >/dev/null &
+flood_pid=$!
+sleep 0.5
+ip netns exec "$ns_cb" "$flood" -i srcs1 -r 2 -n 4 -s 1 >/dev/null
+wait "$flood_pid"
+
+kill -USR1 "$pid"
+sleep 0.5
+
+limited_a=$(awk -v ifname="$ns_a/srcs0:" '$1 == ifname { found = 1 } found && $1 == "rs_ratelimited_source" { print $2; exit }' "$stats")
+limited_b=$(awk -v ifname="$ns_b/srcs0:" '$1 == ifname { found = 1 } found && $1 == "rs_ratelimited_source" { print $2; exit }' "$stats")
+
+echo "flooded_rs_ratelimited_source $limited_a"
+echo "other_rs_ratelimited_source $limited_b"
+
+if [ "${limited_a:-0}" = 0 ] || [ "$limited_b" != 0 ]; then
+	echo "FAIL: rate limiting leaks between namespaces" >&2
+	exit 1
+fi
+
+echo "PASS"
@@ -0,0 +1,326 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+  Router solicitation flood generator for benchmarking uradvd
+
+  Sends router solicitations from many (link-local) source addresses at a
+  fixed rate through a packet socket and records the router advertisements
+  received in response. For every RA, all solicitations sent since the
+  previous RA are considered answered by it.
+*/
+
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include <net/if.h>
+
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+#include <netinet/ip6.h>
+
+#include <sys/socket.h>
+
+
+#define NSEC_PER_MSEC 1000000ull
+#define NSEC_PER_SEC 1000000000ull
+
+/* Time to wait for RAs after the last solicitation, in milliseconds */
+#define DRAIN_TIME 4000u
+
+
+struct __attribute__((__packed__)) rs_frame {
+	struct ethhdr eth;
+	struct ip6_hdr ip6;
+	struct nd_router_solicit rs;
+	uint8_t slla_type;
+	uint8_t slla_len;
+	uint8_t slla[6];
+};
+
+static struct global {
+	int sock;
+	unsigned int ifindex;
+
+	unsigned long rate;
+	unsigned long count;
+	unsigned long sources;
+
+	uint64_t *rs_times;
+	uint64_t *latencies;
+	size_t n_latencies;
+	size_t n_answered;
+
+	size_t n_ra;
+	uint64_t first_ra;
+	uint64_t last_ra;
+	uint64_t min_ra_interval;
+} G = {
+	.sock = -1,
+	.rate = 1000,
+	.count = 10000,
+	.sources = 256,
+};
+
+
+static inline void exit_errno(const char *message) {
+	fprintf(stderr, "rs-flood: error: %s: %s\n", message, strerror(errno));
+	exit(1);
+}
+
+static inline uint64_t now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static inline uint32_t checksum_add(uint32_t sum, const uint8_t *data, size_t len) {
+	size_t i;
+
+	for (i = 0; i + 1 < len; i += 2)
+		sum += (data[i] << 8) | data[i+1];
+
+	return sum;
+}
+
+/* Returns the ICMPv6 checksum of an (even-length) message in network byte order */
+static uint16_t icmp6_checksum(const struct in6_addr *src, const struct in6_addr *dst, const uint8_t *data, size_t len) {
+	uint32_t sum = 0;
+
+	sum = checksum_add(sum, src->s6_addr, 16);
+	sum = checksum_add(sum, dst->s6_addr, 16);
+	sum += len;
+	sum += IPPROTO_ICMPV6;
+	sum = checksum_add(sum, data, len);
+
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return htons(~sum);
+}
+
+static void build_rs(struct rs_frame *frame, unsigned long source) {
+	uint8_t mac[6] = { 0x02, 0x00, 0x5e, source >> 16, source >> 8, source };
+
+	memset(frame, 0, sizeof(*frame));
+
+	memcpy(frame->eth.h_dest, (uint8_t[]){ 0x33, 0x33, 0x00, 0x00, 0x00, 0x02 }, ETH_ALEN);
+	memcpy(frame->eth.h_source, mac, ETH_ALEN);
+	frame->eth.h_proto = htons(ETH_P_IPV6);
+
+	frame->ip6.ip6_flow = htonl(6 << 28);
+	frame->ip6.ip6_plen = htons(sizeof(*frame) - sizeof(frame->eth) - sizeof(frame->ip6));
+	frame->ip6.ip6_nxt = IPPROTO_ICMPV6;
+	frame->ip6.ip6_hlim = 255;
+
+	/* fe80::<mac-based interface identifier> */
+	frame->ip6.ip6_src.s6_addr[0] = 0xfe;
+	frame->ip6.ip6_src.s6_addr[1] = 0x80;
+	frame->ip6.ip6_src.s6_addr[8] = mac[0] ^ 0x02;
+	frame->ip6.ip6_src.s6_addr[9] = mac[1];
+	frame->ip6.ip6_src.s6_addr[10] = mac[2];
+	frame->ip6.ip6_src.s6_addr[11] = 0xff;
+	frame->ip6.ip6_src.s6_addr[12] = 0xfe;
+	frame->ip6.ip6_src.s6_addr[13] = mac[3];
+	frame->ip6.ip6_src.s6_addr[14] = mac[4];
+	frame->ip6.ip6_src.s6_addr[15] = mac[5];
+
+	inet_pton(AF_INET6, "ff02::2", &frame->ip6.ip6_dst);
+
+	frame->rs.nd_rs_type = ND_ROUTER_SOLICIT;
+	frame->slla_type = ND_OPT_SOURCE_LINKADDR;
+	frame->slla_len = 1;
+	memcpy(frame->slla, mac, sizeof(mac));
+
+	struct in6_addr src = frame->ip6.ip6_src, dst = frame->ip6.ip6_dst;
+	frame->rs.nd_rs_cksum = icmp6_checksum(&src, &dst, (const uint8_t *)&frame->rs, ntohs(frame->ip6.ip6_plen));
+}
+
+static void handle_ra(uint64_t t, size_t n_sent) {
+	if (G.n_ra) {
+		uint64_t interval = t - G.last_ra;
+		if (G.n_ra == 1 || interval < G.min_ra_interval)
+			G.min_ra_interval = interval;
+	}
+	else {
+		G.first_ra = t;
+	}
+
+	G.n_ra++;
+	G.last_ra = t;
+
+	for (; G.n_answered < n_sent; G.n_answered++)
+		G.latencies[G.n_latencies++] = t - G.rs_times[G.n_answered];
+}
+
+static void receive_ras(size_t n_sent) {
+	uint8_t buffer[1500] __attribute__((aligned(8)));
+
+	while (true) {
+		ssize_t len = recv(G.sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+
+			exit_errno("recv");
+		}
+
+		const struct ethhdr *eth = (const struct ethhdr *)buffer;
+		const struct ip6_hdr *ip6 = (const struct ip6_hdr *)(eth + 1);
+		const struct icmp6_hdr *icmp6 = (const struct icmp6_hdr *)(ip6 + 1);
+
+		if ((size_t)len < sizeof(*eth) + sizeof(*ip6) + sizeof(*icmp6))
+			continue;
+
+		if (eth->h_proto != htons(ETH_P_IPV6) || ip6->ip6_nxt != IPPROTO_ICMPV6)
+			continue;
+
+		if (icmp6->icmp6_type == ND_ROUTER_ADVERT)
+			handle_ra(now(), n_sent);
+	}
+}
+
+static int cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile_ms(double p) {
+	if (!G.n_latencies)
+		return 0;
+
+	size_t i = (size_t)(p * (G.n_latencies - 1) + 0.5);
+	return (double)G.latencies[i] / NSEC_PER_MSEC;
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: rs-flood [-h] -i <interface> [ -r <solicitations per second> ] [ -n <count> ] [ -s <sources> ]\n");
+}
+
+static void parse_cmdline(int argc, char *argv[]) {
+	const char *ifname = NULL;
+	int c;
+
+	while ((c = getopt(argc, argv, "i:r:n:s:h")) != -1) {
+		switch (c) {
+		case 'i':
+			ifname = optarg;
+			break;
+
+		case 'r':
+			G.rate = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'n':
+			G.count = strtoul(optarg, NULL, 0);
+			break;
+
+		case 's':
+			G.sources = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'h':
+			usage();
+			exit(0);
+
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (!ifname || !G.rate || !G.count || !G.sources || G.sources > 0xffffff) {
+		usage();
+		exit(1);
+	}
+
+	G.ifindex = if_nametoindex(ifname);
+	if (!G.ifindex)
+		exit_errno("can't find interface");
+}
+
+int main(int argc, char *argv[]) {
+	size_t i;
+
+	parse_cmdline(argc, argv);
+
+	G.rs_times = calloc(G.count, sizeof(uint64_t));
+	G.latencies = calloc(G.count, sizeof(uint64_t));
+	if (!G.rs_times || !G.latencies)
+		exit_errno("calloc");
+
+	G.sock = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IPV6));
+	if (G.sock < 0)
+		exit_errno("can't open packet socket");
+
+	struct sockaddr_ll sll = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_IPV6),
+		.sll_ifindex = G.ifindex,
+	};
+	if (bind(G.sock, (struct sockaddr *)&sll, sizeof(sll)) < 0)
+		exit_errno("can't bind packet socket");
+
+	struct rs_frame *frames = calloc(G.sources, sizeof(*frames));
+	if (!frames)
+		exit_errno("calloc");
+
+	for (i = 0; i < G.sources; i++)
+		build_rs(&frames[i], i);
+
+	const uint64_t interval = NSEC_PER_SEC / G.rate;
+	const uint64_t start = now();
+
+	for (i = 0; i < G.count; i++) {
+		const uint64_t deadline = start + i * interval;
+		const struct timespec ts = { .tv_sec = deadline / NSEC_PER_SEC, .tv_nsec = deadline % NSEC_PER_SEC };
+
+		receive_ras(i);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+		G.rs_times[i] = now();
+		if (send(G.sock, &frames[i % G.sources], sizeof(frames[0]), 0) < 0)
+			exit_errno("send");
+	}
+
+	const uint64_t end = now();
+
+	/* Wait for the RA answering the last solicitations */
+	while (now() < end + DRAIN_TIME * NSEC_PER_MSEC && G.n_answered < G.count) {
+		receive_ras(G.count);
+		usleep(1000);
+	}
+
+	qsort(G.latencies, G.n_latencies, sizeof(uint64_t), cmp_u64);
+
+	const double duration = (double)(end - start) / NSEC_PER_SEC;
+
+	printf("solicitations_sent %lu\n", G.count);
+	printf("solicitation_rate %.1f/s\n", G.count / duration);
+	printf("sources %lu\n", G.sources);
+	printf("solicitations_answered %zu\n", G.n_answered);
+	printf("ra_received %zu\n", G.n_ra);
+	if (G.n_ra > 1) {
+		printf("ra_rate %.3f/s\n", (G.n_ra - 1) / ((double)(G.last_ra - G.first_ra) / NSEC_PER_SEC));
+		printf("ra_min_interval_ms %.1f\n", (double)G.min_ra_interval / NSEC_PER_MSEC);
+	}
+	printf("latency_ms p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+	       percentile_ms(0.5), percentile_ms(0.9), percentile_ms(0.99), percentile_ms(1));
+
+	return 0;
+}
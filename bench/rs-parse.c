@@ -0,0 +1,423 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+  Offline driver for rs_validate()
+
+  Replays the router solicitations found in a pcap file (or a built-in set
+  of sample packets) through rs_validate(), prints how they were classified
+  and measures the validation throughput. Sample packets carry the status
+  they must be classified as, and a mismatch makes rs-parse fail. When built
+  with -DRS_FUZZ, this file instead provides a libFuzzer entry point.
+*/
+
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+#include <netinet/ip6.h>
+
+#include "../rs.h"
+
+
+#define NSEC_PER_SEC 1000000000ull
+
+/* pcap link-layer header types */
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+
+#define PCAP_MAGIC 0xa1b2c3d4u
+#define PCAP_MAGIC_NSEC 0xa1b23c4du
+
+
+struct packet {
+	struct in6_addr src;
+	int hoplimit;
+	/* Expected result of rs_validate(), RS_STATUS_MAX if unknown */
+	enum rs_status expected;
+	size_t len;
+	uint8_t *data;
+};
+
+struct pcap_file_header {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_record_header {
+	uint32_t ts_sec;
+	uint32_t ts_frac;
+	uint32_t caplen;
+	uint32_t len;
+};
+
+
+#ifdef RS_FUZZ
+
+/* Checks that the options of a message accepted by rs_validate() cover it
+   exactly, and that the source link-layer address lies within them */
+static void check_valid(const uint8_t *buffer, size_t len) {
+	size_t offset = sizeof(struct nd_router_solicit);
+
+	while (offset < len) {
+		if (len - offset < 2 || !buffer[offset+1] || 8 * (size_t)buffer[offset+1] > len - offset)
+			abort();
+
+		offset += 8 * (size_t)buffer[offset+1];
+	}
+
+	const uint8_t *slla = rs_get_slla(buffer, len);
+	if (slla && (slla < buffer + sizeof(struct nd_router_solicit) + 2 || slla + 6 > buffer + len))
+		abort();
+}
+
+/* The input is an ICMPv6 message; the first byte selects the hop limit and the source address */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	if (size < 1)
+		return 0;
+
+	struct in6_addr src = {};
+	if (data[0] & 1)
+		src.s6_addr[0] = 0xfe, src.s6_addr[1] = 0x80, src.s6_addr[15] = 1;
+
+	int hoplimit = (data[0] & 2) ? 255 : RS_HOPLIMIT_UNKNOWN;
+
+	uint8_t *copy = malloc(size - 1);
+	if (!copy && size > 1)
+		return 0;
+
+	memcpy(copy, data + 1, size - 1);
+	enum rs_status status = rs_validate(copy, size - 1, hoplimit, &src);
+
+	if (status >= RS_STATUS_MAX)
+		abort();
+	if (status == RS_VALID)
+		check_valid(copy, size - 1);
+
+	free(copy);
+
+	return 0;
+}
+
+#else
+
+static struct global {
+	size_t n_packets;
+	size_t max_packets;
+	struct packet *packets;
+} G;
+
+
+static inline void exit_error(const char *message) {
+	fprintf(stderr, "rs-parse: error: %s\n", message);
+	exit(1);
+}
+
+static inline uint64_t now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static inline uint16_t get16(const uint8_t *p) {
+	return (p[0] << 8) | p[1];
+}
+
+static void add_packet(const struct in6_addr *src, int hoplimit, enum rs_status expected, const uint8_t *data, size_t len) {
+	if (G.n_packets == G.max_packets) {
+		G.max_packets = G.max_packets ? 2*G.max_packets : 64;
+		G.packets = realloc(G.packets, G.max_packets * sizeof(*G.packets));
+		if (!G.packets)
+			exit_error("out of memory");
+	}
+
+	struct packet *packet = &G.packets[G.n_packets++];
+	packet->src = *src;
+	packet->hoplimit = hoplimit;
+	packet->expected = expected;
+	packet->len = len;
+	packet->data = malloc(len ? len : 1);
+	if (!packet->data)
+		exit_error("out of memory");
+
+	memcpy(packet->data, data, len);
+}
+
+/* Adds an IPv6 packet if it contains a router solicitation */
+static void add_ipv6(const uint8_t *data, size_t len) {
+	const struct ip6_hdr *ip6 = (const struct ip6_hdr *)data;
+
+	if (len < sizeof(*ip6) || (data[0] >> 4) != 6)
+		return;
+
+	size_t plen = get16(data + offsetof(struct ip6_hdr, ip6_plen));
+	if (plen > len - sizeof(*ip6))
+		plen = len - sizeof(*ip6);
+
+	const uint8_t *p = data + sizeof(*ip6);
+	uint8_t next = ip6->ip6_nxt;
+
+	/* Skip hop-by-hop and destination options headers */
+	while (next == IPPROTO_HOPOPTS || next == IPPROTO_DSTOPTS) {
+		if (plen < 8)
+			return;
+
+		size_t hlen = 8 * (p[1] + 1);
+		if (hlen > plen)
+			return;
+
+		next = p[0];
+		p += hlen;
+		plen -= hlen;
+	}
+
+	if (next != IPPROTO_ICMPV6 || plen < 1 || p[0] != ND_ROUTER_SOLICIT)
+		return;
+
+	struct in6_addr src;
+	memcpy(&src, &ip6->ip6_src, sizeof(src));
+
+	add_packet(&src, ip6->ip6_hlim, RS_STATUS_MAX, p, plen);
+}
+
+static void add_frame(uint32_t linktype, const uint8_t *data, size_t len) {
+	size_t hlen;
+	uint16_t proto;
+
+	switch (linktype) {
+	case LINKTYPE_ETHERNET:
+		hlen = 14;
+		if (len < hlen)
+			return;
+
+		proto = get16(data + 12);
+
+		/* Single 802.1Q tag */
+		if (proto == 0x8100 && len >= 18) {
+			proto = get16(data + 16);
+			hlen = 18;
+		}
+		break;
+
+	case LINKTYPE_LINUX_SLL:
+		hlen = 16;
+		if (len < hlen)
+			return;
+
+		proto = get16(data + 14);
+		break;
+
+	case LINKTYPE_LINUX_SLL2:
+		hlen = 20;
+		if (len < hlen)
+			return;
+
+		proto = get16(data);
+		break;
+
+	case LINKTYPE_RAW:
+	case LINKTYPE_IPV6:
+		hlen = 0;
+		proto = 0x86dd;
+		break;
+
+	default:
+		exit_error("unsupported pcap link type");
+	}
+
+	if (proto == 0x86dd)
+		add_ipv6(data + hlen, len - hlen);
+}
+
+static uint32_t swap32(uint32_t v, bool swap) {
+	return swap ? __builtin_bswap32(v) : v;
+}
+
+static void read_pcap(const char *filename) {
+	FILE *f = fopen(filename, "r");
+	if (!f) {
+		fprintf(stderr, "rs-parse: error: can't open %s: %s\n", filename, strerror(errno));
+		exit(1);
+	}
+
+	struct pcap_file_header fh;
+	if (fread(&fh, sizeof(fh), 1, f) != 1)
+		exit_error("invalid pcap file");
+
+	bool swap;
+	if (fh.magic == PCAP_MAGIC || fh.magic == PCAP_MAGIC_NSEC)
+		swap = false;
+	else if (fh.magic == __builtin_bswap32(PCAP_MAGIC) || fh.magic == __builtin_bswap32(PCAP_MAGIC_NSEC))
+		swap = true;
+	else
+		exit_error("invalid pcap file (pcapng is not supported)");
+
+	const uint32_t linktype = swap32(fh.linktype, swap) & 0xffff;
+	uint8_t *buffer = NULL;
+	size_t buflen = 0;
+
+	while (true) {
+		struct pcap_record_header rh;
+		if (fread(&rh, sizeof(rh), 1, f) != 1)
+			break;
+
+		const uint32_t caplen = swap32(rh.caplen, swap);
+		if (caplen > buflen) {
+			buflen = caplen;
+			buffer = realloc(buffer, buflen);
+			if (!buffer)
+				exit_error("out of memory");
+		}
+
+		if (caplen && fread(buffer, caplen, 1, f) != 1)
+			break;
+
+		add_frame(linktype, buffer, caplen);
+	}
+
+	free(buffer);
+	fclose(f);
+}
+
+/* A set of sample ICMPv6 messages covering all results of rs_validate() */
+static void add_samples(void) {
+	static const struct in6_addr ll = { .s6_addr = { 0xfe, 0x80, [15] = 1 } };
+	static const struct in6_addr unspec = {};
+
+	static const uint8_t rs[] = { ND_ROUTER_SOLICIT, 0, 0, 0, 0, 0, 0, 0 };
+	static const uint8_t rs_slla[] = {
+		ND_ROUTER_SOLICIT, 0, 0, 0, 0, 0, 0, 0,
+		ND_OPT_SOURCE_LINKADDR, 1, 0x02, 0x00, 0x5e, 0x00, 0x00, 0x01,
+	};
+	static const uint8_t rs_slla_nonce[] = {
+		ND_ROUTER_SOLICIT, 0, 0, 0, 0, 0, 0, 0,
+		ND_OPT_SOURCE_LINKADDR, 1, 0x02, 0x00, 0x5e, 0x00, 0x00, 0x01,
+		14 /* Nonce */, 1, 1, 2, 3, 4, 5, 6,
+	};
+	static const uint8_t rs_code[] = { ND_ROUTER_SOLICIT, 1, 0, 0, 0, 0, 0, 0 };
+	static const uint8_t rs_zero_opt[] = {
+		ND_ROUTER_SOLICIT, 0, 0, 0, 0, 0, 0, 0,
+		ND_OPT_SOURCE_LINKADDR, 0, 0x02, 0x00, 0x5e, 0x00, 0x00, 0x01,
+	};
+	static const uint8_t rs_long_opt[] = {
+		ND_ROUTER_SOLICIT, 0, 0, 0, 0, 0, 0, 0,
+		ND_OPT_SOURCE_LINKADDR, 2, 0x02, 0x00, 0x5e, 0x00, 0x00, 0x01,
+	};
+	static const uint8_t rs_trailing[] = {
+		ND_ROUTER_SOLICIT, 0, 0, 0, 0, 0, 0, 0,
+		ND_OPT_SOURCE_LINKADDR,
+	};
+
+	add_packet(&ll, 255, RS_VALID, rs, sizeof(rs));
+	add_packet(&ll, 255, RS_VALID, rs_slla, sizeof(rs_slla));
+	add_packet(&ll, 255, RS_VALID, rs_slla_nonce, sizeof(rs_slla_nonce));
+	add_packet(&unspec, 255, RS_VALID, rs, sizeof(rs));
+	add_packet(&unspec, 255, RS_UNSPEC_SLLA, rs_slla, sizeof(rs_slla));
+	add_packet(&ll, 64, RS_BAD_HOPLIMIT, rs, sizeof(rs));
+	add_packet(&ll, 255, RS_TOO_SHORT, rs, 4);
+	add_packet(&ll, 255, RS_BAD_CODE, rs_code, sizeof(rs_code));
+	add_packet(&ll, 255, RS_BAD_OPTION, rs_zero_opt, sizeof(rs_zero_opt));
+	add_packet(&ll, 255, RS_BAD_OPTION, rs_long_opt, sizeof(rs_long_opt));
+	add_packet(&ll, 255, RS_BAD_OPTION, rs_trailing, sizeof(rs_trailing));
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: rs-parse [-h] [ -r <pcap file> ] [ -n <iterations> ]\n"
+			"Without -r, a built-in set of sample packets is used.\n");
+}
+
+int main(int argc, char *argv[]) {
+	const char *filename = NULL;
+	unsigned long iterations = 1000000;
+	size_t counts[RS_STATUS_MAX] = {};
+	size_t mismatches = 0;
+	size_t i, j;
+	int c;
+
+	while ((c = getopt(argc, argv, "r:n:h")) != -1) {
+		switch (c) {
+		case 'r':
+			filename = optarg;
+			break;
+
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'h':
+			usage();
+			exit(0);
+
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (filename)
+		read_pcap(filename);
+	else
+		add_samples();
+
+	if (!G.n_packets)
+		exit_error("no router solicitations found");
+
+	for (i = 0; i < G.n_packets; i++) {
+		const struct packet *packet = &G.packets[i];
+		enum rs_status status = rs_validate(packet->data, packet->len, packet->hoplimit, &packet->src);
+
+		if (packet->expected != RS_STATUS_MAX && status != packet->expected) {
+			fprintf(stderr, "rs-parse: error: packet %zu classified as %s, expected %s\n",
+				i, rs_status_names[status], rs_status_names[packet->expected]);
+			mismatches++;
+		}
+
+		counts[status]++;
+	}
+
+	printf("packets %zu\n", G.n_packets);
+	for (i = 0; i < RS_STATUS_MAX; i++)
+		printf("rs_%s %zu\n", rs_status_names[i], counts[i]);
+
+	if (mismatches)
+		exit_error("unexpected classification");
+
+	/* Rounds over the whole packet set, so the total is at least <iterations> packets */
+	const size_t rounds = (iterations + G.n_packets - 1) / G.n_packets;
+	volatile unsigned int sink = 0;
+
+	const uint64_t start = now();
+	for (j = 0; j < rounds; j++) {
+		for (i = 0; i < G.n_packets; i++) {
+			const struct packet *packet = &G.packets[i];
+			sink += rs_validate(packet->data, packet->len, packet->hoplimit, &packet->src);
+		}
+	}
+	const uint64_t elapsed = now() - start;
+
+	const double total = (double)rounds * G.n_packets;
+	printf("validated %.0f packets in %.3f s, %.1f ns/packet, %.1f Mpackets/s\n",
+	       total, (double)elapsed / NSEC_PER_SEC, elapsed / total, total / elapsed * 1000);
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,102 @@
+#!/bin/sh
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# RS flood benchmark for uradvd; needs root and iproute2.
+#
+# Creates two network namespaces connected by a veth pair, starts uradvd
+# on one end and floods the other end with router solicitations. The
+# following environment variables control the run:
+#
+#   RATE     solicitations per second (default 1000)
+#   COUNT    number of solicitations (default 10000)
+#   SOURCES  number of distinct source addresses (default 256)
+#   URADVD_ARGS  additional arguments for uradvd
+#
+# The per-source rate limit is disabled, as the flood uses few sources at a
+# high rate; otherwise most solicitations would only measure the path that
+# drops them. It can be enabled again through URADVD_ARGS.
+#
+# Reports the rs-flood results (RS->RA latency percentiles, RA rate) and
+# the CPU time, context switches and, if perf is available, syscalls used
+# by uradvd per solicitation.
+
+set -e
+
+RATE=${RATE:-1000}
+COUNT=${COUNT:-10000}
+SOURCES=${SOURCES:-256}
+
+dir=$(cd "$(dirname "$0")" && pwd)
+uradvd=$dir/../uradvd
+flood=$dir/rs-flood
+
+ns_r=uradvd-bench-r.$$
+ns_c=uradvd-bench-c.$$
+
+pid=
+perf_pid=
+
+cleanup() {
+	[ -n "$perf_pid" ] && kill -INT "$perf_pid" 2>/dev/null || true
+	[ -n "$pid" ] && kill "$pid" 2>/dev/null || true
+	ip netns del "$ns_r" 2>/dev/null || true
+	ip netns del "$ns_c" 2>/dev/null || true
+}
+trap cleanup EXIT INT TERM
+
+# Prints CPU time in ns and voluntary+involuntary context switches of a
+# process; the CPU time is taken from schedstat where available, as it is
+# much more precise than the tick-based utime/stime
+proc_usage() {
+	if [ -r "/proc/$1/schedstat" ] && [ "$(cut -d' ' -f1 "/proc/$1/schedstat")" != 0 ]; then
+		printf '%s ' "$(cut -d' ' -f1 "/proc/$1/schedstat")"
+	else
+		awk -v hz="$(getconf CLK_TCK)" '{ printf "%.0f ", ($14 + $15) * 1e9 / hz }' "/proc/$1/stat"
+	fi
+	awk '/ctxt_switches/ { n += $2 } END { print n }' "/proc/$1/status"
+}
+
+ip netns add "$ns_r"
+ip netns add "$ns_c"
+ip link add bench0 netns "$ns_r" type veth peer name bench1 netns "$ns_c"
+ip -n "$ns_r" link set bench0 up
+ip -n "$ns_c" link set bench1 up
+
+# Wait for DAD of the link-local address to complete
+while ip -n "$ns_r" -6 addr show dev bench0 | grep -q tentative; do
+	sleep 0.1
+done
+
+# shellcheck disable=SC2086
+ip netns exec "$ns_r" "$uradvd" --source-rs-limit 0 -i bench0 -a 2001:db8::/64 $URADVD_ARGS &
+pid=$!
+
+# Let the startup RA go out before measuring
+sleep 1
+
+if command -v perf >/dev/null 2>&1; then
+	perf stat -e raw_syscalls:sys_enter -x, -o "bench-perf.$$" -p "$pid" &
+	perf_pid=$!
+fi
+
+set -- $(proc_usage "$pid")
+cpu_start=$1 ctxt_start=$2
+
+ip netns exec "$ns_c" "$flood" -i bench1 -r "$RATE" -n "$COUNT" -s "$SOURCES"
+
+set -- $(proc_usage "$pid")
+cpu_end=$1 ctxt_end=$2
+
+echo "uradvd_cpu_ns_per_rs $(( (cpu_end - cpu_start) / COUNT ))"
+echo "uradvd_ctxt_switches_per_rs $(awk -v n=$((ctxt_end - ctxt_start)) -v c="$COUNT" 'BEGIN { printf "%.3f", n / c }')"
+
+if [ -n "$perf_pid" ]; then
+	kill -INT "$perf_pid"
+	wait "$perf_pid" 2>/dev/null || true
+	perf_pid=
+	syscalls=$(awk -F, '/raw_syscalls/ { print $1 }' "bench-perf.$$")
+	rm -f "bench-perf.$$"
+	echo "uradvd_syscalls_per_rs $(awk -v n="$syscalls" -v c="$COUNT" 'BEGIN { printf "%.3f", n / c }')"
+else
+	echo "uradvd_syscalls_per_rs n/a (perf not available)"
+fi
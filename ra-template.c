@@ -0,0 +1,253 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+  Router advertisement template generator for the static build of uradvd
+
+  Takes the interface, prefix, RDNSS and lifetime options of uradvd and
+  writes a C header with the configuration and the serialized RAs to
+  stdout. The source link-layer address is left zero; it is the only part
+  that uradvd patches at runtime. This runs on the build host.
+*/
+
+
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#include <net/if.h>
+
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+#include <netinet/ip6.h>
+
+#include "ra.h"
+
+/* The template is a single RA, which must fit into the minimum IPv6 MTU */
+#define MAX_RA_LEN (1280u - sizeof(struct ip6_hdr))
+
+/* Prefixes fitting into a single RA, and addresses into a single RDNSS option */
+#define MAX_PREFIXES ((MAX_RA_LEN - sizeof(struct nd_router_advert) - 8) / sizeof(struct nd_opt_prefix_info))
+#define MAX_RDNSS 127
+
+
+struct prefix {
+	struct in6_addr addr;
+	bool onlink;
+};
+
+static struct global {
+	const char *ifname;
+
+	unsigned long adv_default_lifetime;
+	unsigned long min_ra_interval;
+	unsigned long max_ra_interval;
+
+	size_t n_prefixes;
+	struct prefix prefixes[MAX_PREFIXES];
+
+	size_t n_rdnss;
+	struct in6_addr rdnss[MAX_RDNSS];
+} G = {
+	.adv_default_lifetime = AdvDefaultLifetime,
+	.min_ra_interval = MinRtrAdvInterval,
+	.max_ra_interval = MaxRtrAdvInterval,
+};
+
+
+static inline void exit_error(const char *message, const char *arg) {
+	fprintf(stderr, "ra-template: error: %s %s.\n", message, arg);
+	exit(1);
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: ra-template [-h] -i <interface> -a/-p <prefix> [ -a/-p <prefix> ... ]\n"
+			"                   [ --default-lifetime <seconds> ] [ --rdnss <ip> ... ]\n"
+			"                   [ --ra-interval <min seconds>,<max seconds> ]\n");
+}
+
+static void add_prefix(const char *arg, bool onlink) {
+	struct in6_addr addr;
+	if (!ra_parse_prefix(&addr, arg))
+		exit_error("invalid prefix (only prefixes of length 64 are supported)", arg);
+
+	if (G.n_prefixes == MAX_PREFIXES)
+		exit_error("too many prefixes for a single RA at", arg);
+
+	G.prefixes[G.n_prefixes++] = (struct prefix){ addr, onlink };
+}
+
+static void add_rdnss(const char *arg) {
+	if (G.n_rdnss == MAX_RDNSS)
+		exit_error("too many RDNSS servers at", arg);
+
+	if (inet_pton(AF_INET6, arg, &G.rdnss[G.n_rdnss]) != 1)
+		exit_error("invalid RDNSS IP address", arg);
+
+	G.n_rdnss++;
+}
+
+static void parse_cmdline(int argc, char *argv[]) {
+	char *endptr;
+	int c;
+
+	static struct option long_options[] =
+	{
+		{"default-lifetime", required_argument, 0, 0},
+		{"rdnss", required_argument, 0, 1},
+		{"ra-interval", required_argument, 0, 8},
+		{0, 0, 0, 0}
+	};
+
+	while ((c = getopt_long(argc, argv, "i:a:p:h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 0: // --default-lifetime
+			G.adv_default_lifetime = strtoul(optarg, &endptr, 0);
+
+			if (!*optarg || *endptr || G.adv_default_lifetime > UINT16_MAX)
+				exit_error("invalid default lifetime", optarg);
+
+			break;
+
+		case 1: // --rdnss
+			add_rdnss(optarg);
+			break;
+
+		case 8: // --ra-interval
+			if (!ra_parse_interval(optarg, &G.min_ra_interval, &G.max_ra_interval))
+				exit_error("invalid RA interval", optarg);
+			break;
+
+		case 'i':
+			if (G.ifname)
+				exit_error("only a single interface is supported, got", optarg);
+			/* Network namespaces (<netns>/<interface>) aren't supported by the static build */
+			if (!*optarg || strlen(optarg) >= IFNAMSIZ || strchr(optarg, '/') || strchr(optarg, '"') || strchr(optarg, '\\'))
+				exit_error("invalid interface name", optarg);
+
+			G.ifname = optarg;
+			break;
+
+		case 'a':
+			add_prefix(optarg, false);
+			break;
+
+		case 'p':
+			add_prefix(optarg, true);
+			break;
+
+		case 'h':
+			usage();
+			exit(0);
+
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (optind < argc || !G.ifname || !G.n_prefixes) {
+		usage();
+		exit(1);
+	}
+}
+
+/* Serializes the RA in the same way as build_advert() in uradvd.c, without
+   the MTU option, as the link MTU isn't known at build time. final selects
+   the RA sent on shutdown. */
+static size_t build_advert(uint8_t *buf, bool final, size_t *mac_offset) {
+	const uint16_t router_lifetime = final ? 0 : G.adv_default_lifetime;
+	size_t len = 0, i;
+
+	struct nd_router_advert advert = {
+		.nd_ra_hdr = {
+			.icmp6_type = ND_ROUTER_ADVERT,
+			.icmp6_dataun.icmp6_un_data8 = {AdvCurHopLimit, 0 /* Flags */, (router_lifetime>>8) & 0xff, router_lifetime & 0xff },
+		},
+	};
+	memcpy(buf + len, &advert, sizeof(advert));
+	len += sizeof(advert);
+
+	buf[len++] = ND_OPT_SOURCE_LINKADDR;
+	buf[len++] = 1;
+	*mac_offset = len;
+	len += 6;
+
+	for (i = 0; i < G.n_prefixes; i++) {
+		struct nd_opt_prefix_info prefix = {
+			.nd_opt_pi_type = ND_OPT_PREFIX_INFORMATION,
+			.nd_opt_pi_len = 4,
+			.nd_opt_pi_prefix_len = 64,
+			.nd_opt_pi_flags_reserved = ND_OPT_PI_FLAG_AUTO | (G.prefixes[i].onlink ? ND_OPT_PI_FLAG_ONLINK : 0),
+			.nd_opt_pi_valid_time = htonl(AdvValidLifetime),
+			.nd_opt_pi_preferred_time = htonl(final ? 0 : AdvPreferredLifetime),
+			.nd_opt_pi_prefix = G.prefixes[i].addr,
+		};
+		memcpy(buf + len, &prefix, sizeof(prefix));
+		len += sizeof(prefix);
+	}
+
+	if (G.n_rdnss) {
+		const uint32_t lifetime = htonl(AdvRDNSSLifetime);
+
+		buf[len++] = 25;
+		buf[len++] = 1 + 2*G.n_rdnss;
+		buf[len++] = 0;
+		buf[len++] = 0;
+		memcpy(buf + len, &lifetime, sizeof(lifetime));
+		len += sizeof(lifetime);
+
+		memcpy(buf + len, G.rdnss, G.n_rdnss * sizeof(struct in6_addr));
+		len += G.n_rdnss * sizeof(struct in6_addr);
+	}
+
+	if (len > MAX_RA_LEN) {
+		fprintf(stderr, "ra-template: error: the RA is %zu bytes long, at most %zu fit into a single RA.\n", len, MAX_RA_LEN);
+		exit(1);
+	}
+
+	return len;
+}
+
+static void print_array(const char *name, const uint8_t *buf, size_t len) {
+	size_t i;
+
+	printf("static const uint8_t %s[%zu] = {", name, len);
+
+	for (i = 0; i < len; i++)
+		printf("%s0x%02x,", i % 12 ? " " : "\n\t", buf[i]);
+
+	printf("\n};\n");
+}
+
+int main(int argc, char *argv[]) {
+	/* Large enough for the longest RA the options allow, which is only checked against MAX_RA_LEN afterwards */
+	static uint8_t ra[sizeof(struct nd_router_advert) + 8 + MAX_PREFIXES * sizeof(struct nd_opt_prefix_info) + 8 + sizeof(G.rdnss)];
+	static uint8_t final_ra[sizeof(ra)];
+	size_t mac_offset;
+
+	parse_cmdline(argc, argv);
+
+	size_t len = build_advert(ra, false, &mac_offset);
+	build_advert(final_ra, true, &mac_offset);
+
+	printf("/* Generated by ra-template, do not edit */\n\n"
+	       "#define STATIC_IFNAME \"%s\"\n"
+	       "#define STATIC_DEFAULT_LIFETIME %luu\n"
+	       "#define STATIC_MIN_RA_INTERVAL %luu\n"
+	       "#define STATIC_MAX_RA_INTERVAL %luu\n\n"
+	       "/* Offset of the source link-layer address in the RAs */\n"
+	       "#define STATIC_RA_MAC_OFFSET %zu\n\n",
+	       G.ifname, G.adv_default_lifetime, G.min_ra_interval, G.max_ra_interval, mac_offset);
+
+	print_array("static_ra", ra, len);
+	printf("\n/* Sent on shutdown: router lifetime 0, all prefixes deprecated */\n");
+	print_array("static_final_ra", final_ra, len);
+
+	return 0;
+}
@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+  Router advertisement defaults and the parsing of their configuration
+*/
+
+
+#include "ra.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+
+
+bool ra_parse_prefix(struct in6_addr *addr, const char *prefix) {
+	const size_t len = strlen(prefix)+1;
+	char prefix2[len];
+	memcpy(prefix2, prefix, len);
+
+	char *slash = strchr(prefix2, '/');
+	if (slash) {
+		*slash = 0;
+		if (strcmp(slash+1, "64") != 0)
+			return false;
+	}
+
+	if (inet_pton(AF_INET6, prefix2, addr) != 1)
+		return false;
+
+	static const uint8_t zero[8] = {};
+	return memcmp(addr->s6_addr + 8, zero, 8) == 0;
+}
+
+bool ra_parse_interval(const char *arg, unsigned long *min, unsigned long *max) {
+	char *endptr;
+
+	*min = strtoul(arg, &endptr, 0);
+	if (endptr == arg || *endptr != ',')
+		return false;
+
+	const char *max_arg = endptr+1;
+	*max = strtoul(max_arg, &endptr, 0);
+	if (endptr == max_arg || *endptr)
+		return false;
+
+	return *min >= MIN_RA_INTERVAL && *min <= *max && *max <= MAX_RA_INTERVAL;
+}
@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+  Router advertisement defaults and the parsing of their configuration,
+  shared by uradvd and the RA template generator of the static build
+*/
+
+#pragma once
+
+
+#include <stdbool.h>
+
+#include <netinet/in.h>
+
+
+/* These are in seconds */
+#define AdvValidLifetime 86400u
+#define AdvPreferredLifetime 14400u
+#define AdvDefaultLifetime 0u
+#define AdvCurHopLimit 64u
+#define AdvRDNSSLifetime 1200u
+
+/* Default bounds of the adaptive unsolicited RA interval */
+#define MinRtrAdvInterval 200u
+#define MaxRtrAdvInterval 600u
+
+/* Bounds for configured intervals; the lower one makes sure that no interval
+   shorter than 3 s (the minimum MinRtrAdvInterval of RFC 4861) is drawn */
+#define MIN_RA_INTERVAL 4u
+#define MAX_RA_INTERVAL 1800u
+
+
+/* Parses a prefix of length 64, given with or without the /64 */
+bool ra_parse_prefix(struct in6_addr *addr, const char *prefix);
+
+/*
+  Parses an RA interval given as <min seconds>,<max seconds>. Returns false
+  when it is malformed or not within MIN_RA_INTERVAL..MAX_RA_INTERVAL.
+*/
+bool ra_parse_interval(const char *arg, unsigned long *min, unsigned long *max);
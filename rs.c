@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+  Router solicitation validation
+*/
+
+
+#include "rs.h"
+
+#include <netinet/icmp6.h>
+
+
+const char *const rs_status_names[RS_STATUS_MAX] = {
+	[RS_VALID] = "valid",
+	[RS_TOO_SHORT] = "too_short",
+	[RS_BAD_HOPLIMIT] = "bad_hoplimit",
+	[RS_BAD_CODE] = "bad_code",
+	[RS_BAD_OPTION] = "bad_option",
+	[RS_UNSPEC_SLLA] = "unspec_slla",
+};
+
+
+enum rs_status rs_validate(const uint8_t *buffer, size_t len, int hoplimit, const struct in6_addr *src) {
+	if (len < sizeof(struct nd_router_solicit))
+		return RS_TOO_SHORT;
+
+	if (hoplimit != RS_HOPLIMIT_UNKNOWN && hoplimit != 255)
+		return RS_BAD_HOPLIMIT;
+
+	const struct nd_router_solicit *s = (const struct nd_router_solicit *)buffer;
+	if (s->nd_rs_hdr.icmp6_type != ND_ROUTER_SOLICIT || s->nd_rs_hdr.icmp6_code != 0)
+		return RS_BAD_CODE;
+
+	const uint8_t *opt = buffer + sizeof(struct nd_router_solicit), *end = buffer + len;
+
+	while (opt < end) {
+		/* Option type and length must be present */
+		if (end - opt < 2)
+			return RS_BAD_OPTION;
+
+		/* The length is given in units of 8 bytes and must not be zero */
+		size_t opt_len = 8 * (size_t)opt[1];
+		if (!opt_len || opt_len > (size_t)(end - opt))
+			return RS_BAD_OPTION;
+
+		if (opt[0] == ND_OPT_SOURCE_LINKADDR && IN6_IS_ADDR_UNSPECIFIED(src))
+			return RS_UNSPEC_SLLA;
+
+		opt += opt_len;
+	}
+
+	return RS_VALID;
+}
+
+const uint8_t * rs_get_slla(const uint8_t *buffer, size_t len) {
+	const uint8_t *opt = buffer + sizeof(struct nd_router_solicit), *end = buffer + len;
+
+	while (opt < end) {
+		size_t opt_len = 8 * (size_t)opt[1];
+
+		if (opt[0] == ND_OPT_SOURCE_LINKADDR && opt_len == 8)
+			return opt + 2;
+
+		opt += opt_len;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+  Router solicitation validation
+*/
+
+#pragma once
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <netinet/in.h>
+
+
+/* Result of rs_validate() */
+enum rs_status {
+	RS_VALID,
+	RS_TOO_SHORT,
+	RS_BAD_HOPLIMIT,
+	RS_BAD_CODE,
+	RS_BAD_OPTION,
+	RS_UNSPEC_SLLA,
+	RS_STATUS_MAX,
+};
+
+/* Passed as hoplimit when the hop limit of a packet is unknown */
+#define RS_HOPLIMIT_UNKNOWN (-1)
+
+extern const char *const rs_status_names[RS_STATUS_MAX];
+
+
+/*
+  Validates a received router solicitation according to RFC 4861, section 6.1.1
+
+  buffer and len describe the ICMPv6 message, src is the IPv6 source
+  address the message was received from.
+*/
+enum rs_status rs_validate(const uint8_t *buffer, size_t len, int hoplimit, const struct in6_addr *src);
+
+/*
+  Returns the 6-byte link-layer address contained in the source link-layer
+  address option of a router solicitation that has been accepted by
+  rs_validate(), or NULL if there is no such option
+*/
+const uint8_t * rs_get_slla(const uint8_t *buffer, size_t len);
@@ -8,21 +8,27 @@
 #define _GNU_SOURCE
 
 #include <errno.h>
-#include <ifaddrs.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <poll.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <syslog.h>
 #include <time.h>
 #include <unistd.h>
 
 #include <arpa/inet.h>
 
+#include <linux/filter.h>
+#include <linux/neighbour.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 
@@ -30,31 +36,135 @@
 
 #include <netinet/in.h>
 #include <netinet/icmp6.h>
+#include <netinet/ip6.h>
 
 #include <sys/types.h>
-#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <sys/uio.h>
+#include <sys/un.h>
 #include <sys/stat.h>
 
+#include "ra.h"
+#include "rs.h"
 
-#define MAX_PREFIXES 8
-#define MAX_RDNSS 3
+#ifdef URADVD_STATIC
+#include "ra-template.h"
 
-/* These are in seconds */
-#define AdvValidLifetime 86400u
-#define AdvPreferredLifetime 14400u
-#define AdvDefaultLifetime 0u
-#define AdvCurHopLimit 64u
-#define AdvRDNSSLifetime 1200u
+/* The single interface has an RA timer, and there is the refresh timer; the
+   signalfd and the ICMP and RTNL sockets of the interface's namespace are polled */
+#define STATIC_TIMERS 2
+#define STATIC_WATCHES 3
+#endif
 
-#define MinRtrAdvInterval 200u
-#define MaxRtrAdvInterval 600u
 
-/* And these in milliseconds */
+/* The static build's hash only ever holds its single interface */
+#ifdef URADVD_STATIC
+#define IFACE_HASH_SIZE 1
+#else
+#define IFACE_HASH_SIZE 64
+#endif
+
+#define RTNL_BUFFER_SIZE 16384
+
+/* Number of solicitations received with a single recvmmsg() call, and
+   maximum number of batches handled per wakeup */
+#define RS_BATCH_SIZE 16
+#define RS_MAX_BATCHES 16
+#define RS_CBUF_SIZE 128
+
+/* These are in milliseconds */
 #define MAX_RA_DELAY_TIME 500u
 #define MIN_DELAY_BETWEEN_RAS 3000u
+#define MAX_INITIAL_RTR_ADVERT_INTERVAL 16000u
+
+/* RAs failing with a transient error are retried after SEND_RETRY_DELAY,
+   doubling the delay for each of at most SEND_MAX_RETRIES retries */
+#define SEND_RETRY_DELAY 100u
+#define SEND_MAX_RETRIES 6u
+
+#define MAX_INITIAL_RTR_ADVERTISEMENTS 3u
+#define MAX_FINAL_RTR_ADVERTISEMENTS 3u
+
+#define REFRESH_DELAY 50u
+
+/* The unsolicited RA interval is halved when at least this many
+   solicitations per interval have been seen */
+#define RS_BUSY_THRESHOLD 2u
+
+/* Statistics */
+#define LATENCY_BUCKETS 14
+#define RS_PENDING_MAX 32
+
+/* Maximum number of solicitors answered with unicast RAs in one delay window */
+#define MAX_UNICAST_PENDING 64
+
+/* Default solicitation rate limits per interface and per source address, in
+   solicitations per second and burst size */
+#define RS_IFACE_RATE 1000u
+#define RS_IFACE_BURST 100u
+#define RS_SOURCE_RATE 1u
+#define RS_SOURCE_BURST 5u
+
+/* Number of source addresses tracked for rate limiting; must not exceed NO_SOURCE */
+#define SOURCE_TABLE_SIZE 256
+#define SOURCE_HASH_SIZE 256
+
+/* Control socket connections and maximum command line length */
+#define CONTROL_MAX_CLIENTS 4
+#define CONTROL_BUFFER_SIZE 512
+
+/* Default receive buffer size of the RTNL event socket */
+#define RTNL_RCVBUF (1024u*1024u)
+
+/* Log messages are queued in a ring buffer of LOG_RING_SIZE bytes; messages
+   not fitting into it are dropped. Every message text is rate limited
+   separately, the number of suppressed messages is reported after
+   LOG_REPORT_DELAY. Writes blocked by a full output are retried after
+   LOG_RETRY_DELAY; these are in milliseconds. */
+#define LOG_RING_SIZE 16384
+#define LOG_LINE_MAX 512
+#define LOG_CLASSES 32
+#define LOG_CLASS_RATE 1u
+#define LOG_CLASS_BURST 5u
+#define LOG_REPORT_DELAY 10000u
+#define LOG_RETRY_DELAY 100u
+#define LOG_EXIT_TIMEOUT 1000u
+
+
+/* Interface refresh flags */
+#define DIRTY_STATE 0x1	/* Re-evaluate the known link state */
+#define DIRTY_ADDRS 0x2	/* Look up the link-local address again */
+#define DIRTY_LINK 0x4	/* Look up ifindex and MAC address again */
+#define DIRTY_ROUTES 0x8	/* Look up the routes to learn prefixes from again */
 
+/* Where an advertised prefix comes from */
+#define PREFIX_STATIC 0x1	/* Command line or control socket */
+#define PREFIX_LEARNED 0x2	/* Addresses or routes of the interface */
+
+/* Log output formats */
+#define LOG_FORMAT_PLAIN 0	/* uradvd: error: <message> on stderr */
+#define LOG_FORMAT_JSON 1	/* One JSON object per line on stderr */
+#define LOG_FORMAT_SYSLOG 2	/* Datagrams to /dev/log */
+
+/* Values of config.learn_prefixes */
+#define LEARN_AUTO 1	/* Like -a */
+#define LEARN_ONLINK 2	/* Like -p */
+
+
+#define for_each_iface(iface) for (iface = G.ifaces; iface; iface = iface->next)
+
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define NSEC_PER_MSEC 1000000ull
+#define NSEC_PER_SEC 1000000000ull
+
+#define TIMER_IDLE SIZE_MAX
+
+#define NO_SOURCE UINT16_MAX
 
 struct icmpv6_opt {
 	uint8_t type;
@@ -63,13 +173,6 @@ struct icmpv6_opt {
 };
 
 
-struct iface {
-	bool ok;
-	unsigned int ifindex;
-	struct in6_addr ifaddr;
-	uint8_t mac[6];
-};
-
 struct __attribute__((__packed__)) nd_opt_rdnss {
 	uint8_t nd_opt_rdnss_type;
 	uint8_t nd_opt_rdnss_len;
@@ -77,555 +180,4482 @@ struct __attribute__((__packed__)) nd_opt_rdnss {
 	uint32_t nd_opt_rdnss_lifetime;
 };
 
-static struct global {
-	struct iface iface;
 
-	struct timespec time;
-	struct timespec next_advert;
-	struct timespec next_advert_earliest;
+/* The solicitations answered by a multicast RA. first and last are the
+   receive times of the first and last of them; clamp_delay is the time the
+   RA has been postponed by to keep MIN_DELAY_BETWEEN_RAS, and sent the time
+   it has been sent at. */
+struct rs_aggregate {
+	uint32_t count;
+	uint64_t first;
+	uint64_t last;
+	bool clamped;
+	bool storm;
+	uint64_t clamp_delay;
+	uint64_t sent;
+};
+
+/* Solicitations that have not been answered by an RA yet, for latency
+   accounting. When the array is full, further solicitations are added to
+   the count of the newest entry. */
+struct rs_pending {
+	uint64_t time;
+	uint32_t count;
+};
+
+/* Counters are never reset. Bucket i of the latency histogram counts
+   RS->RA latencies in [2^(i-1), 2^i) ms, the last bucket all longer ones. */
+struct iface_stats {
+	uint64_t rs_received;
+	uint64_t rs_status[RS_STATUS_MAX];
+	uint64_t ra_sent;
+	uint64_t ra_failed;
+	/* Failed sends of multicast and unicast RAs by error class */
+	uint64_t ra_failed_transient;
+	uint64_t ra_failed_fatal;
+	/* RAs given up after SEND_MAX_RETRIES retries */
+	uint64_t ra_dropped;
+	uint64_t rs_ratelimited_source;
+	uint64_t rs_ratelimited_iface;
+	uint64_t ra_unicast_sent;
+	uint64_t ra_unicast_failed;
+	/* RAs from other routers with the same content as ours, and own RAs skipped because of them */
+	uint64_t ra_peer_matching;
+	uint64_t ra_suppressed;
+	/* Delay windows in which too many solicitors for unicast replies were waiting */
+	uint64_t unicast_fallbacks;
+	uint64_t rs_latency[LATENCY_BUCKETS];
+	/* Time from startup to the first multicast RA in ns, 0 before it has been sent */
+	uint64_t first_ra;
+
+	/* Multicast RAs that have answered solicitations, the solicitations
+	   answered by them, and how many of them have been postponed to keep
+	   MIN_DELAY_BETWEEN_RAS (by clamp_delay ns altogether) or because of
+	   a solicitation storm */
+	uint64_t ra_aggregated;
+	uint64_t rs_aggregated;
+	uint32_t rs_aggregated_max;
+	uint64_t ra_clamped;
+	uint64_t clamp_delay;
+	uint64_t ra_storm_delayed;
+	struct rs_aggregate last_aggregate;
+	/* Solicitations answered by matching RAs of other routers instead */
+	uint64_t rs_peer_answered;
+
+	size_t n_rs_pending;
+	struct rs_pending rs_pending[RS_PENDING_MAX];
+};
+
+/* A timer in the global timer heap; deadline is in nanoseconds of CLOCK_MONOTONIC */
+struct timer {
+	uint64_t deadline;
+	/* Position in the heap, TIMER_IDLE when the timer isn't pending; the
+	   static build has no heap and only tells both cases apart */
+	size_t index;
+	void (*cb)(struct timer *timer);
+};
+
+/* A token bucket that gains a token every NSEC_PER_SEC/rate ns and holds at
+   most burst tokens; rate 0 means unlimited */
+struct rate_limit {
+	unsigned int rate;
+	unsigned int burst;
+};
+
+/* Rate limiting state of the log messages with a given text */
+struct log_class {
+	/* The message text; classes are told apart by pointer */
+	const char *message;
+	uint64_t tat;
+	/* Messages suppressed since suppressed_since */
+	unsigned int suppressed;
+	uint64_t suppressed_since;
+};
+
+/* Formatted log records waiting to be written, each terminated by a newline */
+struct log_ring {
+	size_t start, len;
+	char buf[LOG_RING_SIZE];
+};
+
+/* Rate limiting state of a source address; entries are kept in LRU order
+   and the least recently used one is reused for unknown sources */
+struct source_entry {
+	struct in6_addr addr;
+	/* The interface the source has been seen on, as ifindexes are only
+	   unique within a namespace; NULL for unused entries */
+	const struct iface *iface;
+	uint64_t tat;
+
+	uint16_t hash_next;
+	uint16_t lru_prev;
+	uint16_t lru_next;
+};
+
+struct source_table {
+	uint32_t seed;
+	uint16_t hash[SOURCE_HASH_SIZE];
+	/* Most and least recently used entries */
+	uint16_t lru_head;
+	uint16_t lru_tail;
+	struct source_entry entries[SOURCE_TABLE_SIZE];
+};
+
+/* A solicitor waiting for a unicast RA */
+struct unicast_pending {
+	struct in6_addr addr;
+	bool has_mac;
+	uint8_t mac[6];
+	/* Time and number of the solicitations from this address, for latency accounting */
+	uint64_t time;
+	uint32_t count;
+};
+
+/* A file descriptor registered with the epoll instance (or polled by the static build) */
+struct watch {
+	int fd;
+	void (*cb)(struct watch *watch);
+};
+
+struct prefix {
+	struct in6_addr addr;
+	bool onlink;
+	/* PREFIX_* flags */
+	uint8_t source;
+
+	/* Times at which the prefix expires and is deprecated, or 0 for prefixes
+	   that are advertised with the full lifetimes forever */
+	uint64_t valid_until;
+	uint64_t preferred_until;
+
+	/* Offset of the prefix information option in the interface's RA buffer */
+	size_t ra_offset;
+};
+
+struct config {
+	bool adv_default_lifetime_set;
+	uint16_t adv_default_lifetime;
+
+	/* Bounds of the adaptive unsolicited RA interval, in seconds */
+	bool ra_interval_set;
+	unsigned int min_ra_interval;
+	unsigned int max_ra_interval;
+
+	/* Learn prefixes from the interface's addresses and routes (LEARN_* or 0) */
+	unsigned int learn_prefixes;
+
+	/* Dynamically sized; size is the number of allocated entries */
+	size_t n_prefixes, prefixes_size;
+	struct prefix *prefixes;
+
+	size_t n_rdnss, rdnss_size;
+	struct in6_addr *rdnss;
+};
+
+/* A dynamically sized set of /64 prefixes with their expiry times */
+struct prefix_set {
+	size_t n, size;
+	struct prefix *prefixes;
+};
+
+/* A prefix or RDNSS server removed at runtime, which is announced with
+   lifetime 0 in the next few multicast RAs */
+struct withdrawal {
+	bool rdnss;
+	bool onlink;
+	struct in6_addr addr;
+	unsigned int adverts;
+};
+
+/* A connection to the control socket */
+struct control_client {
+	struct watch watch;
+	size_t len;
+	char buffer[CONTROL_BUFFER_SIZE];
+};
+
+/* A network namespace with served interfaces. Its ICMP and RTNL sockets are
+   created inside the namespace and keep operating in it; ifindexes are only
+   unique within a namespace, so each has its own hash table. */
+struct netns {
+	struct netns *next;
+	/* Name below /run/netns, NULL for the namespace uradvd is started in */
+	const char *name;
 
 	int icmp_sock;
+	struct watch icmp_watch;
+
 	int rtnl_sock;
+	int rtnl_query_sock;
+	struct watch rtnl_watch;
+
+	struct iface *iface_hash[IFACE_HASH_SIZE];
+};
 
+struct iface {
+	/* All configured interfaces, in command line order */
+	struct iface *next;
+	/* Chain in the ifindex hash table of the namespace */
+	struct iface *hash_next;
+
+	struct netns *netns;
+	/* The interface as given on the command line, [<netns>/]<ifname> */
+	const char *name;
 	const char *ifname;
+	struct config conf;
 
-	uint16_t adv_default_lifetime;
+	/* Removed prefixes and RDNSS servers still announced with lifetime 0 */
+	size_t n_withdrawn, withdrawn_size;
+	struct withdrawal *withdrawn;
+
+	/* Prefixes found in the last dumps of the interface's addresses and routes */
+	struct prefix_set addr_prefixes;
+	struct prefix_set route_prefixes;
+
+	/* Interfaces that have received valid solicitations in the current
+	   handle_icmp() call are chained by rs_batch_next; rs_solicited is cleared
+	   again when a peer RA has answered them */
+	bool rs_batch;
+	bool rs_solicited;
+	struct iface *rs_batch_next;
+
+	/* DIRTY_* flags of the state to refresh when the coalescing window has passed */
+	unsigned int dirty;
 
-	size_t n_prefixes;
-	struct in6_addr prefixes[MAX_PREFIXES];
-	bool prefixes_onlink[MAX_PREFIXES];
+	bool ok;
+	/* Set when ifindex, ifaddr or mac are modified, cleared by update_interface() */
+	bool changed;
+	unsigned int ifindex;
+	struct in6_addr ifaddr;
+	uint8_t mac[6];
 
-	size_t n_rdnss;
-	struct in6_addr rdnss[MAX_RDNSS];
+	/* Token bucket for all solicitations received on the interface */
+	uint64_t rs_tat;
+
+	struct timer advert_timer;
+	uint64_t next_advert_earliest;
+	/* Number of retries of the pending RA after transient send errors */
+	unsigned int send_retries;
+
+	/* Unsolicited RAs are sent after a random delay in [MinRtrAdvInterval,
+	   ra_interval]; ra_interval is in milliseconds, starts at and never
+	   exceeds MaxRtrAdvInterval, and is shortened under solicitation load */
+	uint64_t ra_interval;
+	uint64_t last_advert;
+	uint32_t rs_since_advert;
+
+	/* Remaining RAs of the initial burst, which are sent at most initial_interval apart */
+	unsigned int initial_adverts;
+	/* Remaining final RAs to send before exiting */
+	unsigned int final_adverts;
+
+	/* Last time a multicast RA with the same content as ours has been received from another router */
+	uint64_t last_peer_advert;
+	/* The pending multicast RA has been scheduled in response to solicitations */
+	bool advert_solicited;
+	/* Solicitations waiting for the next multicast RA */
+	struct rs_aggregate rs_aggregate;
+
+	/* Solicitors that are answered with unicast RAs when unicast_timer expires */
+	struct timer unicast_timer;
+	size_t n_unicast;
+	struct unicast_pending unicast[MAX_UNICAST_PENDING];
+
+	struct iface_stats stats;
+
+	uint32_t mtu;
+
+	/* Pre-serialized RAs, rebuilt when n_ra is 0. The content is split into
+	   several RAs when it doesn't fit into the link MTU; all of them are
+	   stored back to back in ra_buf. */
+	size_t n_ra, ra_size;
+	struct iovec *ra;
+	/* RAs of the pending multicast RA set that have been sent before a
+	   transient error; a retry resumes after them */
+	size_t n_ra_sent;
+	size_t ra_buf_size;
+	uint8_t *ra_buf;
+};
+
+static struct global {
+	uint64_t now;
+	/* Time main() has been entered */
+	uint64_t start_time;
+
+#ifdef URADVD_STATIC
+	/* All timers and watches, which are scanned and polled in every event loop iteration */
+	size_t n_timers;
+	struct timer *timers[STATIC_TIMERS];
+	size_t n_watches;
+	struct watch *watches[STATIC_WATCHES];
+#else
+	int epoll_fd;
+
+	/* Min-heap of pending timers, served by a single timerfd */
+	int timer_fd;
+	uint64_t timer_fd_deadline;
+	size_t n_timers;
+	size_t max_timers;
+	struct timer **timers;
+#endif
+
+	/* A single ICMPv6 and RTNL socket pair serves all interfaces of a namespace */
+	struct netns *netns;
+	int rtnl_rcvbuf;
+
+	size_t n_ifaces;
+	struct iface *ifaces;
+
+	/* Coalescing window for netlink-triggered refreshes, in milliseconds */
+	unsigned int refresh_delay;
+	struct timer refresh_timer;
+
+	/* Attach BPF programs to the ICMP sockets to drop invalid packets in the kernel */
+	bool kernel_filter;
+
+	/* Maximum number of solicitors answered with unicast RAs in one delay
+	   window before falling back to a multicast RA; 0 disables unicast RAs */
+	unsigned int unicast_max;
+
+	/* Upper bounds of the random delay of solicited multicast RAs in ms,
+	   when a single or several solicitations are waiting for it. When at
+	   least storm_threshold solicitations are waiting (0 disables this),
+	   the RA is delayed by up to ra_delay_storm ms from the first one instead. */
+	unsigned int ra_delay_single;
+	unsigned int ra_delay;
+	unsigned int storm_threshold;
+	unsigned int ra_delay_storm;
+
+	/* Skip own RAs while other routers advertise the same content */
+	bool suppress;
+
+	/* Number of RAs and their maximum interval (in milliseconds) sent after
+	   startup and whenever an interface's state or content changes */
+	unsigned int initial_adverts;
+	unsigned int initial_interval;
+
+	/* Number of final RAs sent on shutdown */
+	unsigned int final_adverts;
+	bool shutdown;
+
+	const char *control_path;
+	struct watch control_watch;
+
+	struct rate_limit rs_limit_iface;
+	struct rate_limit rs_limit_source;
+
+	/* Settings given before the first -i apply to all interfaces */
+	struct config defaults;
+
+	unsigned int log_format;
+	int log_fd;
+	/* log_fd is a socket, which is written with MSG_DONTWAIT */
+	bool log_socket;
+	/* stderr, opened non-blocking if possible; log_fd unless logging to syslog */
+	int stderr_fd;
+	bool stderr_socket;
+	/* Statistics requested by SIGUSR1 that are still being written to stderr_fd */
+	struct {
+		char *buf;
+		size_t len, written;
+	} stats_out;
+	struct timer log_timer;
+	struct rate_limit log_limit;
+	size_t n_log_classes;
+	uint64_t log_suppressed;
+	uint64_t log_dropped;
+	/* Dropped messages not reported yet */
+	uint64_t log_dropped_pending;
 } G = {
-	.rtnl_sock = -1,
-	.icmp_sock = -1,
-	.adv_default_lifetime = AdvDefaultLifetime,
+#ifndef URADVD_STATIC
+	.epoll_fd = -1,
+	.timer_fd = -1,
+#endif
+	.rtnl_rcvbuf = RTNL_RCVBUF,
+	.refresh_delay = REFRESH_DELAY,
+	.initial_adverts = MAX_INITIAL_RTR_ADVERTISEMENTS,
+	.initial_interval = MAX_INITIAL_RTR_ADVERT_INTERVAL,
+	.final_adverts = MAX_FINAL_RTR_ADVERTISEMENTS,
+	.ra_delay_single = MAX_RA_DELAY_TIME,
+	.ra_delay = MAX_RA_DELAY_TIME,
+	.rs_limit_iface = { RS_IFACE_RATE, RS_IFACE_BURST },
+	.rs_limit_source = { RS_SOURCE_RATE, RS_SOURCE_BURST },
+	.log_fd = STDERR_FILENO,
+	.stderr_fd = STDERR_FILENO,
+	.log_limit = { LOG_CLASS_RATE, LOG_CLASS_BURST },
+	.defaults = {
+		.adv_default_lifetime = AdvDefaultLifetime,
+		.min_ra_interval = MinRtrAdvInterval,
+		.max_ra_interval = MaxRtrAdvInterval,
+	},
 };
 
+/* The large tables are kept out of G, so they end up in .bss instead of
+   taking up space in the initialized data of the binary */
+#ifndef URADVD_STATIC
+static struct log_ring log_ring;
+static struct log_class log_classes[LOG_CLASSES];
+static struct source_table sources;
+static struct control_client control_clients[CONTROL_MAX_CLIENTS];
+#endif
+
+
+/*
+  Takes a token from a bucket, returning false if it is empty. The bucket is
+  implemented as the equivalent generic cell rate algorithm, which only needs
+  the theoretical arrival time of the next solicitation as state.
+*/
+static bool rate_limit_take(const struct rate_limit *limit, uint64_t *tat) {
+	if (!limit->rate)
+		return true;
+
+	const uint64_t interval = NSEC_PER_SEC / limit->rate;
+	uint64_t t = *tat > G.now ? *tat : G.now;
+
+	if (t - G.now > (limit->burst - 1) * interval)
+		return false;
+
+	*tat = t + interval;
+	return true;
+}
+
+
+#ifdef URADVD_STATIC
+
+/* The static build writes its log messages to stderr right away, without
+   rate limiting or other formats */
+static void log_record(int priority __attribute__((unused)), const char *message, int err, unsigned int suppressed __attribute__((unused))) {
+	/* Some messages carry a trailing newline */
+	int len = strcspn(message, "\n");
 
-static inline void print_error(const char *prefix, const char *message, int err) {
 	if (err)
-		fprintf(stderr, "uradvd: %s: %s: %s\n", prefix, message, strerror(err));
+		fprintf(stderr, "uradvd: error: %.*s: %s\n", len, message, strerror(err));
 	else
-		fprintf(stderr, "uradvd: %s: %s\n", prefix, message);
+		fprintf(stderr, "uradvd: error: %.*s\n", len, message);
 }
 
-static inline void exit_error(const char *message, int err) {
-	print_error("error", message, err);
-	exit(1);
+static inline void log_error(const char *message, int err) {
+	log_record(LOG_ERR, message, err, 0);
 }
 
-static inline void exit_errno(const char *message) {
-	exit_error(message, errno);
+static inline void log_flush_exit(void) {
 }
 
-static inline void warn_error(const char *message, int err) {
-	print_error("error", message, err);
+#else
+
+/* Writes as much of the pending statistics as possible without blocking.
+   Returns false while some of them are left. */
+static bool stats_flush(void) {
+	while (G.stats_out.written < G.stats_out.len) {
+		const char *data = G.stats_out.buf + G.stats_out.written;
+		const size_t len = G.stats_out.len - G.stats_out.written;
+		ssize_t ret;
+
+		if (G.stderr_socket)
+			ret = send(G.stderr_fd, data, len, MSG_DONTWAIT|MSG_NOSIGNAL);
+		else
+			ret = write(G.stderr_fd, data, len);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+				return false;
+
+			break;
+		}
+
+		G.stats_out.written += ret;
+	}
+
+	free(G.stats_out.buf);
+	G.stats_out.buf = NULL;
+	G.stats_out.len = G.stats_out.written = 0;
+
+	return true;
 }
 
-static inline void warn_errno(const char *message) {
-	warn_error(message, errno);
+/* Writes as many queued log records as possible without blocking. Records
+   are sent as separate datagrams to syslog. When the output fails for other
+   reasons than being full, the queued records are discarded. Pending
+   statistics share the output with plain and JSON records, so they are
+   written when all queued records are out, and records wait for statistics
+   that have been written partially. */
+static void log_flush(void) {
+	struct log_ring *ring = &log_ring;
+
+	if (G.stats_out.written && !stats_flush())
+		return;
+
+	while (ring->len) {
+		const size_t first = ring->start + ring->len > LOG_RING_SIZE ? LOG_RING_SIZE - ring->start : ring->len;
+		struct iovec vec[2] = {
+			{ .iov_base = ring->buf + ring->start, .iov_len = first },
+			{ .iov_base = ring->buf, .iov_len = ring->len - first },
+		};
+		char record[LOG_LINE_MAX];
+
+		if (G.log_format == LOG_FORMAT_SYSLOG) {
+			size_t len = 0;
+
+			while (len < ring->len && len < sizeof(record)) {
+				record[len] = ring->buf[(ring->start + len) % LOG_RING_SIZE];
+				if (record[len++] == '\n')
+					break;
+			}
+
+			vec[0] = (struct iovec){ .iov_base = record, .iov_len = len - 1 };
+			vec[1].iov_len = 0;
+		}
+
+		ssize_t ret;
+		if (G.log_socket) {
+			const struct msghdr msg = { .msg_iov = vec, .msg_iovlen = 2 };
+			ret = sendmsg(G.log_fd, &msg, MSG_DONTWAIT|MSG_NOSIGNAL);
+		}
+		else {
+			ret = writev(G.log_fd, vec, 2);
+		}
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+				return;
+
+			for (; ring->len; ring->len--) {
+				if (ring->buf[(ring->start + ring->len - 1) % LOG_RING_SIZE] == '\n')
+					G.log_dropped++;
+			}
+			break;
+		}
+
+		/* The newline isn't sent with datagrams */
+		if (G.log_format == LOG_FORMAT_SYSLOG)
+			ret = vec[0].iov_len + 1;
+
+		ring->start = (ring->start + ret) % LOG_RING_SIZE;
+		ring->len -= ret;
+	}
+
+	if (G.stats_out.len && !ring->len)
+		stats_flush();
 }
 
+static void log_queue(const char *line, size_t len) {
+	struct log_ring *ring = &log_ring;
 
-static inline void update_time(void) {
-	clock_gettime(CLOCK_MONOTONIC, &G.time);
+	if (len > LOG_RING_SIZE - ring->len) {
+		G.log_dropped++;
+		G.log_dropped_pending++;
+		return;
+	}
+
+	size_t end = (ring->start + ring->len) % LOG_RING_SIZE;
+	size_t first = len < LOG_RING_SIZE - end ? len : LOG_RING_SIZE - end;
+
+	memcpy(ring->buf + end, line, first);
+	memcpy(ring->buf, line + first, len - first);
+	ring->len += len;
 }
 
-/* Compares two timespecs and returns true if tp1 is after tp2 */
-static inline bool timespec_after(const struct timespec *tp1, const struct timespec *tp2) {
-	return (tp1->tv_sec > tp2->tv_sec ||
-		(tp1->tv_sec == tp2->tv_sec && tp1->tv_nsec > tp2->tv_nsec));
+/* Appends a JSON string literal to a buffer of size bytes that has len bytes in use */
+static size_t log_put_json_string(char *buf, size_t size, size_t len, const char *str) {
+	if (len < size)
+		buf[len++] = '"';
+
+	for (; *str && len + 7 < size; str++) {
+		unsigned char c = *str;
+
+		if (c == '"' || c == '\\') {
+			buf[len++] = '\\';
+			buf[len++] = c;
+		}
+		else if (c < 0x20) {
+			len += snprintf(buf + len, size - len, "\\u%04x", c);
+		}
+		else {
+			buf[len++] = c;
+		}
+	}
+
+	if (len < size)
+		buf[len++] = '"';
+
+	return len;
 }
 
-/* Returns (tp1 - tp2) in milliseconds  */
-static inline int timespec_diff(const struct timespec *tp1, const struct timespec *tp2) {
-	return ((tp1->tv_sec - tp2->tv_sec))*1000 + (tp1->tv_nsec - tp2->tv_nsec)/1e6;
+/* Formats a log record in the configured output format and queues it.
+   suppressed is non-zero for the report of suppressed messages. */
+static void log_record(int priority, const char *message, int err, unsigned int suppressed) {
+	char line[LOG_LINE_MAX];
+	const size_t size = sizeof(line) - 1;
+	size_t len = 0;
+
+	/* Some messages carry a trailing newline, which is no part of the record */
+	char text[LOG_LINE_MAX];
+	snprintf(text, sizeof(text), "%s", message);
+	text[strcspn(text, "\n")] = 0;
+
+	switch (G.log_format) {
+	case LOG_FORMAT_JSON: {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+
+		len = snprintf(line, size, "{\"time\":%lld.%03ld,\"level\":\"%s\",\"message\":",
+			       (long long)ts.tv_sec, ts.tv_nsec / 1000000, priority == LOG_ERR ? "error" : "notice");
+		len = log_put_json_string(line, size, len, text);
+
+		if (err && len < size) {
+			len += snprintf(line + len, size - len, ",\"error\":");
+			if (len < size)
+				len = log_put_json_string(line, size, len, strerror(err));
+		}
+		if (suppressed && len < size)
+			len += snprintf(line + len, size - len, ",\"suppressed\":%u", suppressed);
+		if (len < size)
+			len += snprintf(line + len, size - len, "}");
+
+		break;
+	}
+
+	case LOG_FORMAT_SYSLOG:
+		len = snprintf(line, size, "<%d>uradvd[%ld]: ", LOG_DAEMON | priority, (long)getpid());
+		break;
+
+	default:
+		len = snprintf(line, size, "uradvd: ");
+	}
+
+	if (G.log_format != LOG_FORMAT_JSON && len < size) {
+		if (suppressed)
+			len += snprintf(line + len, size - len, "%u similar messages suppressed: %s", suppressed, text);
+		else if (err)
+			len += snprintf(line + len, size - len, "error: %s: %s", text, strerror(err));
+		else
+			len += snprintf(line + len, size - len, "error: %s", text);
+	}
+
+	/* Truncated records still end with a newline */
+	if (len > size)
+		len = size;
+	line[len++] = '\n';
+
+	log_queue(line, len);
 }
 
-static inline void timespec_add(struct timespec *tp, unsigned int ms) {
-	tp->tv_sec += ms/1000;
-	tp->tv_nsec += (ms%1000) * 1e6;
+/* Reports the counts of suppressed messages of the classes whose first
+   suppressed message is at least LOG_REPORT_DELAY old, or of all classes */
+static void log_report_suppressed(bool all) {
+	size_t i;
+
+	for (i = 0; i < G.n_log_classes; i++) {
+		struct log_class *class = &log_classes[i];
+
+		if (!class->suppressed)
+			continue;
+		if (!all && G.now - class->suppressed_since < LOG_REPORT_DELAY * NSEC_PER_MSEC)
+			continue;
+
+		log_record(LOG_NOTICE, class->message, 0, class->suppressed);
+		class->suppressed = 0;
+	}
 
-	if (tp->tv_nsec >= 1e9) {
-		tp->tv_nsec -= 1e9;
-		tp->tv_sec++;
+	if (G.log_dropped_pending) {
+		char message[64];
+		snprintf(message, sizeof(message), "%" PRIu64 " log messages dropped", G.log_dropped_pending);
+		G.log_dropped_pending = 0;
+		log_record(LOG_NOTICE, message, 0, 0);
 	}
 }
 
+/* Returns the rate limiting state of a message text. When the table is full,
+   the class with the oldest activity is reused. */
+static struct log_class * log_get_class(const char *message) {
+	struct log_class *class, *oldest = NULL;
+	size_t i;
+
+	for (i = 0; i < G.n_log_classes; i++) {
+		class = &log_classes[i];
 
-static inline int setsockopt_int(int socket, int level, int option, int value) {
-	return setsockopt(socket, level, option, &value, sizeof(value));
+		if (class->message == message)
+			return class;
+		if (!oldest || class->tat < oldest->tat)
+			oldest = class;
+	}
+
+	if (G.n_log_classes < LOG_CLASSES) {
+		class = &log_classes[G.n_log_classes++];
+	}
+	else {
+		class = oldest;
+		if (class->suppressed)
+			log_record(LOG_NOTICE, class->message, 0, class->suppressed);
+	}
+
+	*class = (struct log_class){ .message = message };
+	return class;
 }
 
+/* Logs an error message without ever blocking */
+static void log_error(const char *message, int err) {
+	struct log_class *class = log_get_class(message);
 
-static void init_random(void) {
-	unsigned int seed;
-	int fd = open("/dev/urandom", O_RDONLY);
-	if (fd < 0)
-		exit_errno("can't open /dev/urandom");
+	if (!rate_limit_take(&G.log_limit, &class->tat)) {
+		if (!class->suppressed++)
+			class->suppressed_since = G.now;
 
-	if (read(fd, &seed, sizeof(seed)) != sizeof(seed))
-		exit_errno("can't read from /dev/urandom");
+		G.log_suppressed++;
+		return;
+	}
 
-	close(fd);
+	log_record(LOG_ERR, message, err, 0);
+	log_flush();
+}
 
-	srandom(seed);
+/* Writes out the queued log records before exiting, waiting at most
+   LOG_EXIT_TIMEOUT for a blocked output */
+static void log_flush_exit(void) {
+	struct pollfd pfd = { .fd = G.log_fd, .events = POLLOUT };
+	unsigned int waited = 0;
+
+	log_report_suppressed(true);
+	log_flush();
+
+	while (log_ring.len && waited < LOG_EXIT_TIMEOUT) {
+		if (poll(&pfd, 1, LOG_RETRY_DELAY) < 0 && errno != EINTR)
+			break;
+
+		waited += LOG_RETRY_DELAY;
+		log_flush();
+	}
 }
 
-static inline int rand_range(int min, int max) {
-	unsigned int r = (unsigned int)random();
-	return (r%(max-min) + min);
+#endif
+
+static inline void exit_error(const char *message, int err) {
+	log_error(message, err);
+	log_flush_exit();
+	exit(1);
 }
 
-static void init_icmp(void) {
-	G.icmp_sock = socket(AF_INET6, SOCK_RAW|SOCK_NONBLOCK, IPPROTO_ICMPV6);
-	if (G.icmp_sock < 0)
-		exit_errno("can't open ICMP socket");
+static inline void exit_errno(const char *message) {
+	exit_error(message, errno);
+}
+
+#ifndef URADVD_STATIC
 
-	setsockopt_int(G.icmp_sock, IPPROTO_RAW, IPV6_CHECKSUM, 2);
+/* Exits with an error message about the given name; as the message text
+   isn't constant, it bypasses the rate limiting of log_error() */
+static void exit_error_name(const char *message, const char *name, int err) {
+	char text[LOG_LINE_MAX];
+	snprintf(text, sizeof(text), "%s %s", message, name);
 
-	setsockopt_int(G.icmp_sock, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, 255);
-	setsockopt_int(G.icmp_sock, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, 1);
+	log_record(LOG_ERR, text, err, 0);
+	log_flush_exit();
+	exit(1);
+}
 
-	setsockopt_int(G.icmp_sock, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, 1);
+#endif
 
-	struct icmp6_filter filter;
-	ICMP6_FILTER_SETBLOCKALL(&filter);
-	ICMP6_FILTER_SETPASS(ND_ROUTER_SOLICIT, &filter);
-	setsockopt(G.icmp_sock, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(filter));
+#ifndef URADVD_STATIC
+
+/* Makes room for at least one more element after the n used ones of a
+   dynamically sized array; size is the number of allocated elements */
+static void * array_grow(void *array, size_t n, size_t *size, size_t elem_size) {
+	if (n < *size)
+		return array;
+
+	size_t new_size = *size ? 2 * *size : 4;
+
+	array = realloc(array, new_size * elem_size);
+	if (!array)
+		exit_errno("realloc");
+
+	*size = new_size;
+	return array;
 }
 
-static void init_rtnl(void) {
-	G.rtnl_sock = socket(AF_NETLINK, SOCK_DGRAM|SOCK_NONBLOCK, NETLINK_ROUTE);
-	if (G.rtnl_sock < 0)
-		exit_errno("can't open RTNL socket");
+#endif
 
-	struct sockaddr_nl snl = {
-		.nl_family = AF_NETLINK,
-		.nl_groups = RTMGRP_LINK | RTMGRP_IPV6_IFADDR,
-	};
-	if (bind(G.rtnl_sock, (struct sockaddr *)&snl, sizeof(snl)) < 0)
-		exit_errno("can't bind RTNL socket");
+static inline void warn_error(const char *message, int err) {
+	log_error(message, err);
 }
 
+static inline void warn_errno(const char *message) {
+	warn_error(message, errno);
+}
 
-static void schedule_advert(bool nodelay) {
-	struct timespec t = G.time;
 
-	if (nodelay)
-		timespec_add(&t, rand_range(0, MAX_RA_DELAY_TIME));
-	else
-		timespec_add(&t, rand_range(MinRtrAdvInterval*1000, MaxRtrAdvInterval*1000));
+static inline void update_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	G.now = (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
 
-	if (timespec_after(&G.next_advert_earliest, &t))
-		t = G.next_advert_earliest;
 
-	if (!nodelay || timespec_after(&G.next_advert, &t))
-		G.next_advert = t;
+static inline bool timer_pending(const struct timer *timer) {
+	return timer->index != TIMER_IDLE;
 }
 
+#ifdef URADVD_STATIC
 
-static int join_multicast(void) {
-	struct ipv6_mreq mreq = {
-		.ipv6mr_multiaddr = {
-			.s6_addr = {
-				/* all-routers address */
-				0xff, 0x02, 0x00, 0x00,
-				0x00, 0x00, 0x00, 0x00,
-				0x00, 0x00, 0x00, 0x00,
-				0x00, 0x00, 0x00, 0x02,
-			}
-		},
-		.ipv6mr_interface = G.iface.ifindex,
-	};
+/* The few timers of the static build are registered once and scanned
+   linearly, which needs much less code than the heap */
+static inline void timer_init(struct timer *timer, void (*cb)(struct timer *timer)) {
+	*timer = (struct timer){ .index = TIMER_IDLE, .cb = cb };
+	G.timers[G.n_timers++] = timer;
+}
 
-	if (setsockopt(G.icmp_sock, IPPROTO_IPV6, IPV6_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == 0) {
-		return 2;
+static inline void timer_cancel(struct timer *timer) {
+	timer->index = TIMER_IDLE;
+}
+
+/* (Re-)arms a timer for an absolute deadline */
+static inline void timer_set(struct timer *timer, uint64_t deadline) {
+	timer->deadline = deadline;
+	timer->index = 0;
+}
+
+/* Returns the time until the earliest pending deadline in ms as a poll()
+   timeout, or -1 when no timer is pending */
+static int timer_timeout(void) {
+	uint64_t deadline = UINT64_MAX;
+	size_t i;
+
+	for (i = 0; i < G.n_timers; i++) {
+		if (timer_pending(G.timers[i]) && G.timers[i]->deadline < deadline)
+			deadline = G.timers[i]->deadline;
 	}
-	else if (errno != EADDRINUSE) {
-		warn_errno("can't join multicast group");
+
+	if (deadline == UINT64_MAX)
+		return -1;
+	if (deadline <= G.now)
 		return 0;
-	}
 
-	return 1;
+	return (deadline - G.now + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC;
 }
 
-static void update_interface(void) {
-	struct iface old;
+/* Timers that are re-armed for a deadline that has passed already by their
+   callbacks are run in the next iteration, after a poll() with timeout 0 */
+static void run_timers(void) {
+	size_t i;
 
-	memcpy(&old, &G.iface, sizeof(struct iface));
-	memset(&G.iface, 0, sizeof(struct iface));
+	for (i = 0; i < G.n_timers; i++) {
+		struct timer *timer = G.timers[i];
 
-	/* Update ifindex */
-	G.iface.ifindex = if_nametoindex(G.ifname);
-	if (!G.iface.ifindex)
-		return;
+		if (timer_pending(timer) && timer->deadline <= G.now) {
+			timer_cancel(timer);
+			timer->cb(timer);
+		}
+	}
+}
 
-	/* Update MAC address */
-	struct ifreq ifr = {};
-	strncpy(ifr.ifr_name, G.ifname, sizeof(ifr.ifr_name)-1);
-	if (ioctl(G.icmp_sock, SIOCGIFHWADDR, &ifr) < 0)
-		return;
+#else
 
-	memcpy(G.iface.mac, ifr.ifr_hwaddr.sa_data, sizeof(G.iface.mac));
+static inline void timer_init(struct timer *timer, void (*cb)(struct timer *timer)) {
+	*timer = (struct timer){ .index = TIMER_IDLE, .cb = cb };
+}
 
-	struct ifaddrs *addrs, *addr;
-	if (getifaddrs(&addrs) < 0) {
-		warn_errno("getifaddrs");
-		return;
+static inline void timer_heap_put(struct timer *timer, size_t index) {
+	G.timers[index] = timer;
+	timer->index = index;
+}
+
+static void timer_heap_up(struct timer *timer) {
+	size_t index = timer->index;
+
+	while (index > 0) {
+		size_t parent = (index - 1) / 2;
+		if (G.timers[parent]->deadline <= timer->deadline)
+			break;
+
+		timer_heap_put(G.timers[parent], index);
+		index = parent;
+	}
+
+	timer_heap_put(timer, index);
+}
+
+static void timer_heap_down(struct timer *timer) {
+	size_t index = timer->index;
+
+	while (true) {
+		size_t child = 2*index + 1;
+		if (child >= G.n_timers)
+			break;
+
+		if (child + 1 < G.n_timers && G.timers[child+1]->deadline < G.timers[child]->deadline)
+			child++;
+
+		if (timer->deadline <= G.timers[child]->deadline)
+			break;
+
+		timer_heap_put(G.timers[child], index);
+		index = child;
+	}
+
+	timer_heap_put(timer, index);
+}
+
+static void timer_cancel(struct timer *timer) {
+	if (!timer_pending(timer))
+		return;
+
+	struct timer *last = G.timers[--G.n_timers];
+
+	if (last != timer) {
+		timer_heap_put(last, timer->index);
+		timer_heap_up(last);
+		timer_heap_down(last);
+	}
+
+	timer->index = TIMER_IDLE;
+}
+
+/* (Re-)arms a timer for an absolute deadline */
+static void timer_set(struct timer *timer, uint64_t deadline) {
+	if (!timer_pending(timer)) {
+		if (G.n_timers == G.max_timers) {
+			size_t max = G.max_timers ? 2*G.max_timers : 16;
+			struct timer **timers = realloc(G.timers, max * sizeof(*timers));
+			if (!timers)
+				exit_errno("realloc");
+
+			G.timers = timers;
+			G.max_timers = max;
+		}
+
+		timer_heap_put(timer, G.n_timers++);
+	}
+
+	timer->deadline = deadline;
+	timer_heap_up(timer);
+	timer_heap_down(timer);
+}
+
+#endif
+
+static inline void timer_set_in(struct timer *timer, uint64_t ms) {
+	timer_set(timer, G.now + ms * NSEC_PER_MSEC);
+}
+
+#ifndef URADVD_STATIC
+
+/* Makes the timerfd expire at the earliest pending deadline; it is disarmed
+   when no timer is pending, as a zero it_value means */
+static void timer_fd_update(void) {
+	uint64_t deadline = G.n_timers ? G.timers[0]->deadline : 0;
+
+	if (deadline == G.timer_fd_deadline)
+		return;
+
+	struct itimerspec its = {
+		.it_value = {
+			.tv_sec = deadline / NSEC_PER_SEC,
+			.tv_nsec = deadline % NSEC_PER_SEC,
+		},
+	};
+
+	if (timerfd_settime(G.timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		exit_errno("timerfd_settime");
+
+	G.timer_fd_deadline = deadline;
+}
+
+static void run_timers(void) {
+	while (G.n_timers && G.timers[0]->deadline <= G.now) {
+		struct timer *timer = G.timers[0];
+
+		timer_cancel(timer);
+		timer->cb(timer);
+	}
+}
+
+static void handle_timer_fd(struct watch *watch) {
+	uint64_t expirations;
+
+	if (read(watch->fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+		warn_errno("read");
+
+	/* Force rearming, the timerfd has expired */
+	G.timer_fd_deadline = 0;
+}
+
+#endif
+
+
+#ifdef URADVD_STATIC
+
+static inline void watch_add(struct watch *watch, int fd, void (*cb)(struct watch *watch)) {
+	watch->fd = fd;
+	watch->cb = cb;
+
+	G.watches[G.n_watches++] = watch;
+}
+
+/* Waits for the next timer deadline or file descriptor event, and handles the events */
+static void handle_events(void) {
+	struct pollfd fds[STATIC_WATCHES];
+	size_t i;
+
+	for (i = 0; i < G.n_watches; i++)
+		fds[i] = (struct pollfd){ .fd = G.watches[i]->fd, .events = POLLIN };
+
+	if (poll(fds, G.n_watches, timer_timeout()) < 0) {
+		if (errno == EINTR)
+			return;
+
+		exit_errno("poll");
+	}
+
+	update_time();
+
+	for (i = 0; i < G.n_watches; i++) {
+		if (fds[i].revents)
+			G.watches[i]->cb(G.watches[i]);
+	}
+}
+
+#else
+
+static void watch_add(struct watch *watch, int fd, void (*cb)(struct watch *watch)) {
+	watch->fd = fd;
+	watch->cb = cb;
+
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.ptr = watch,
+	};
+
+	if (epoll_ctl(G.epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+		exit_errno("epoll_ctl");
+}
+
+static void init_event_loop(void) {
+	G.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (G.epoll_fd < 0)
+		exit_errno("epoll_create1");
+
+	G.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+	if (G.timer_fd < 0)
+		exit_errno("timerfd_create");
+
+	static struct watch timer_watch;
+	watch_add(&timer_watch, G.timer_fd, handle_timer_fd);
+}
+
+#endif
+
+
+#ifndef URADVD_STATIC
+
+static void handle_log_timer(struct timer *timer __attribute__((unused))) {
+	log_report_suppressed(false);
+	log_flush();
+}
+
+/* Arms the log timer for the next retry of blocked writes or the next report
+   of suppressed messages; called once per event loop iteration */
+static void log_schedule(void) {
+	uint64_t deadline = 0;
+	size_t i;
+
+	if (log_ring.len || G.stats_out.len)
+		deadline = G.now + LOG_RETRY_DELAY * NSEC_PER_MSEC;
+
+	for (i = 0; i < G.n_log_classes; i++) {
+		const struct log_class *class = &log_classes[i];
+		if (!class->suppressed)
+			continue;
+
+		uint64_t report = class->suppressed_since + LOG_REPORT_DELAY * NSEC_PER_MSEC;
+		if (!deadline || report < deadline)
+			deadline = report;
+	}
+
+	if (deadline && (!timer_pending(&G.log_timer) || deadline < G.log_timer.deadline))
+		timer_set(&G.log_timer, deadline);
+}
+
+/* Sets up the log output. Pipes and terminals are reopened with O_NONBLOCK,
+   which doesn't affect the file description shared with other processes;
+   sockets (like a journald stream) are written with MSG_DONTWAIT instead. */
+static void init_log(void) {
+	struct stat st;
+
+	timer_init(&G.log_timer, handle_log_timer);
+
+	if (fstat(STDERR_FILENO, &st) == 0) {
+		if (S_ISSOCK(st.st_mode)) {
+			G.stderr_socket = true;
+		}
+		else if (S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode)) {
+			int fd = open("/proc/self/fd/2", O_WRONLY|O_NONBLOCK|O_CLOEXEC);
+			if (fd >= 0)
+				G.stderr_fd = fd;
+		}
+	}
+
+	G.log_fd = G.stderr_fd;
+	G.log_socket = G.stderr_socket;
+
+	if (G.log_format == LOG_FORMAT_SYSLOG) {
+		const struct sockaddr_un addr = { .sun_family = AF_UNIX, .sun_path = "/dev/log" };
+		int fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+
+		if (fd >= 0 && connect(fd, (const struct sockaddr *)&addr, sizeof(addr)) == 0) {
+			G.log_fd = fd;
+			G.log_socket = true;
+			return;
+		}
+
+		int err = errno;
+		if (fd >= 0)
+			close(fd);
+
+		G.log_format = LOG_FORMAT_PLAIN;
+		warn_error("can't connect to /dev/log, logging to stderr", err);
+	}
+}
+
+#endif
+
+
+static inline int setsockopt_int(int socket, int level, int option, int value) {
+	return setsockopt(socket, level, option, &value, sizeof(value));
+}
+
+
+/* Seeds the PRNG used for RA timing. getrandom() needs no file descriptor;
+   with GRND_NONBLOCK, it fails instead of waiting for the entropy pool early
+   at boot, and /dev/urandom (which never blocks) is used then. */
+static void init_random(void) {
+	unsigned int seed;
+
+	if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) == sizeof(seed)) {
+		srandom(seed);
+		return;
+	}
+
+	int fd = open("/dev/urandom", O_RDONLY);
+	if (fd < 0)
+		exit_errno("can't open /dev/urandom");
+
+	if (read(fd, &seed, sizeof(seed)) != sizeof(seed))
+		exit_errno("can't read from /dev/urandom");
+
+	close(fd);
+
+	srandom(seed);
+}
+
+static inline int rand_range(int min, int max) {
+	unsigned int r = (unsigned int)random();
+	return (r%(max-min) + min);
+}
+
+/* Returns a random delay in [min, max), or min if the range is empty */
+static inline unsigned int random_delay(unsigned int min, unsigned int max) {
+	return max > min ? (unsigned int)rand_range(min, max) : min;
+}
+
+#ifdef URADVD_STATIC
+
+/* The static build has no --kernel-filter */
+static inline void update_icmp_filter(struct netns *ns __attribute__((unused))) {
+}
+
+#else
+
+/* Installs a socket filter that passes only router solicitations (and, when
+   suppressing, router advertisements) that are received on one of the served
+   interfaces of the namespace and pass the basic header checks of
+   rs_validate(), which are still performed in userspace in any case. The
+   interface check is left to userspace as well when there are more
+   interfaces than a single BPF jump can skip. */
+static void update_icmp_filter(struct netns *ns) {
+	const struct iface *iface;
+	size_t n = 0;
+
+	if (!G.kernel_filter)
+		return;
+
+	for_each_iface(iface) {
+		if (iface->netns == ns && iface->ifindex)
+			n++;
+	}
+
+	const bool check_ifindex = (n <= UINT8_MAX);
+
+	struct sock_filter code[15 + (check_ifindex ? n : 0)];
+	size_t i = 0;
+
+	/* The packet must be a multiple of 8 bytes long, and at least as long as the RS header */
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_LEN, 0);
+	code[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, sizeof(struct nd_router_solicit), 0, 9);
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 7);
+	code[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0, 0, 7);
+
+	/* ICMPv6 type and code */
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_B|BPF_ABS, offsetof(struct icmp6_hdr, icmp6_type));
+	code[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ND_ROUTER_SOLICIT, 1, 0);
+	code[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, G.suppress ? ND_ROUTER_ADVERT : ND_ROUTER_SOLICIT, 0, 4);
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_B|BPF_ABS, offsetof(struct icmp6_hdr, icmp6_code));
+	code[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0, 0, 2);
+
+	/* Hop limit in the IPv6 header */
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_B|BPF_ABS, SKF_NET_OFF + (int)offsetof(struct ip6_hdr, ip6_hlim));
+	code[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 255, 1, 0);
+
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, 0);
+
+	/* Receiving interface */
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS, SKF_AD_OFF + SKF_AD_IFINDEX);
+
+	if (check_ifindex) {
+		size_t k = 0;
+
+		for_each_iface(iface) {
+			if (iface->netns == ns && iface->ifindex)
+				code[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, iface->ifindex, n - k++, 0);
+		}
+
+		code[i++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, 0);
+	}
+	else {
+		code[i++] = (struct sock_filter)BPF_STMT(BPF_JMP|BPF_JA, 0);
+	}
+
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, UINT32_MAX);
+
+	const struct sock_fprog prog = {
+		.len = i,
+		.filter = code,
+	};
+
+	if (setsockopt(ns->icmp_sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0)
+		warn_errno("can't attach socket filter");
+}
+
+#endif
+
+static void init_icmp(struct netns *ns) {
+	ns->icmp_sock = socket(AF_INET6, SOCK_RAW|SOCK_NONBLOCK, IPPROTO_ICMPV6);
+	if (ns->icmp_sock < 0)
+		exit_errno("can't open ICMP socket");
+
+	setsockopt_int(ns->icmp_sock, IPPROTO_RAW, IPV6_CHECKSUM, 2);
+
+	setsockopt_int(ns->icmp_sock, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, 255);
+	setsockopt_int(ns->icmp_sock, IPPROTO_IPV6, IPV6_UNICAST_HOPS, 255);
+	setsockopt_int(ns->icmp_sock, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, 1);
+
+	setsockopt_int(ns->icmp_sock, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, 1);
+
+	/* The receiving interface of every packet is taken from its packet info;
+	   the destination address tells multicast RAs of other routers from unicast ones */
+	setsockopt_int(ns->icmp_sock, IPPROTO_IPV6, IPV6_RECVPKTINFO, 1);
+
+	struct icmp6_filter filter;
+	ICMP6_FILTER_SETBLOCKALL(&filter);
+	ICMP6_FILTER_SETPASS(ND_ROUTER_SOLICIT, &filter);
+#ifndef URADVD_STATIC
+	if (G.suppress)
+		ICMP6_FILTER_SETPASS(ND_ROUTER_ADVERT, &filter);
+#endif
+	setsockopt(ns->icmp_sock, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(filter));
+
+	update_icmp_filter(ns);
+}
+
+static void init_rtnl(struct netns *ns) {
+	ns->rtnl_sock = socket(AF_NETLINK, SOCK_DGRAM|SOCK_NONBLOCK, NETLINK_ROUTE);
+	if (ns->rtnl_sock < 0)
+		exit_errno("can't open RTNL socket");
+
+	struct sockaddr_nl snl = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = RTMGRP_LINK | RTMGRP_IPV6_IFADDR,
+	};
+
+#ifndef URADVD_STATIC
+	/* Route events are only needed to learn prefixes */
+	const struct iface *iface;
+	for_each_iface(iface) {
+		if (iface->netns == ns && iface->conf.learn_prefixes)
+			snl.nl_groups |= RTMGRP_IPV6_ROUTE;
+	}
+#endif
+
+	if (bind(ns->rtnl_sock, (struct sockaddr *)&snl, sizeof(snl)) < 0)
+		exit_errno("can't bind RTNL socket");
+
+	/* A large buffer absorbs event bursts; SO_RCVBUFFORCE ignores rmem_max, but needs CAP_NET_ADMIN */
+	if (setsockopt_int(ns->rtnl_sock, SOL_SOCKET, SO_RCVBUFFORCE, G.rtnl_rcvbuf) < 0 &&
+	    setsockopt_int(ns->rtnl_sock, SOL_SOCKET, SO_RCVBUF, G.rtnl_rcvbuf) < 0)
+		warn_errno("can't set RTNL socket receive buffer size");
+
+	/* Requests are made on a separate socket, so their replies don't mix with events */
+	ns->rtnl_query_sock = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE);
+	if (ns->rtnl_query_sock < 0)
+		exit_errno("can't open RTNL socket");
+
+	/* Makes the kernel filter address dumps by ifindex; it is fine if this
+	   isn't supported, as replies are checked in userspace in any case */
+	setsockopt_int(ns->rtnl_query_sock, SOL_NETLINK, NETLINK_GET_STRICT_CHK, 1);
+
+	struct timeval tv = { .tv_sec = 1 };
+	setsockopt(ns->rtnl_query_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+#ifdef URADVD_STATIC
+
+/* The interface of the static build is always in uradvd's own namespace */
+static void init_netns(void) {
+	init_icmp(G.netns);
+	init_rtnl(G.netns);
+}
+
+#else
+
+static void enter_netns(const char *name) {
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "/run/netns/%s", name);
+
+	int fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		exit_error_name("can't open network namespace", name, errno);
+
+	if (setns(fd, CLONE_NEWNET) < 0)
+		exit_error_name("can't enter network namespace", name, errno);
+
+	close(fd);
+}
+
+/* Creates the sockets of all namespaces. Sockets stay in the namespace they
+   have been created in, so uradvd only switches namespaces for the socket()
+   calls and returns to its own one afterwards; everything else, including
+   the control socket, lives in the initial namespace. */
+static void init_netns(void) {
+	struct netns *ns;
+	int self = -1;
+
+	for (ns = G.netns; ns; ns = ns->next) {
+		if (ns->name) {
+			if (self < 0) {
+				self = open("/proc/self/ns/net", O_RDONLY|O_CLOEXEC);
+				if (self < 0)
+					exit_errno("can't open own network namespace");
+			}
+
+			enter_netns(ns->name);
+		}
+
+		init_icmp(ns);
+		init_rtnl(ns);
+
+		if (ns->name && setns(self, CLONE_NEWNET) < 0)
+			exit_errno("can't return to own network namespace");
+	}
+
+	if (self >= 0)
+		close(self);
+}
+
+#endif
+
+#ifdef URADVD_STATIC
+
+/* The static build serves a single interface, and handles all RTNL events in userspace */
+static inline void update_rtnl_filter(struct netns *ns __attribute__((unused))) {
+}
+
+#else
+
+/* Installs a socket filter on the RTNL event socket that passes only link and
+   address messages concerning interfaces we serve. As long as not all of them
+   exist, all RTM_NEWLINK messages are passed as well, as they are needed to
+   learn the ifindex of new interfaces. The outgoing interface of routes is only
+   found in an attribute, so route messages are just checked for /64 routes of
+   the main table; they are only received at all when prefixes are learned. */
+static void update_rtnl_filter(struct netns *ns) {
+	const struct iface *iface;
+	bool all_links = false;
+	size_t n = 0;
+
+	for_each_iface(iface) {
+		if (iface->netns != ns)
+			continue;
+
+		if (iface->ifindex)
+			n++;
+		else
+			all_links = true;
+	}
+
+	struct sock_filter code[17 + 2*n];
+	size_t i = 0;
+
+	/* Netlink headers are in host byte order, while BPF loads are big-endian */
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_H|BPF_ABS, offsetof(struct nlmsghdr, nlmsg_type));
+	code[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, htons(RTM_NEWLINK), 12, 0);
+	code[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, htons(RTM_DELLINK), 12, 0);
+	code[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, htons(RTM_NEWADDR), 11, 0);
+	code[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, htons(RTM_DELADDR), 10, 0);
+	code[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, htons(RTM_NEWROUTE), 2, 0);
+	code[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, htons(RTM_DELROUTE), 1, 0);
+
+	/* Other message types are passed unchanged */
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, UINT32_MAX);
+
+	/* RTM_NEWROUTE, RTM_DELROUTE */
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_B|BPF_ABS, NLMSG_HDRLEN + offsetof(struct rtmsg, rtm_dst_len));
+	code[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 64, 0, 3);
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_B|BPF_ABS, NLMSG_HDRLEN + offsetof(struct rtmsg, rtm_table));
+	code[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, RT_TABLE_MAIN, 0, 1);
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, UINT32_MAX);
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, 0);
+
+	/* RTM_NEWLINK */
+	if (all_links)
+		code[i++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, UINT32_MAX);
+	else
+		code[i++] = (struct sock_filter)BPF_STMT(BPF_JMP|BPF_JA, 0);
+
+	/* Everything else is checked by ifindex; ifa_index is at the same offset as ifi_index */
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS, NLMSG_HDRLEN + offsetof(struct ifinfomsg, ifi_index));
+
+	for_each_iface(iface) {
+		if (iface->netns != ns || !iface->ifindex)
+			continue;
+
+		code[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, htonl(iface->ifindex), 0, 1);
+		code[i++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, UINT32_MAX);
+	}
+
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, 0);
+
+	const struct sock_fprog prog = {
+		.len = i,
+		.filter = code,
+	};
+
+	if (setsockopt(ns->rtnl_sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0)
+		warn_errno("can't attach RTNL socket filter");
+}
+
+#endif
+
+/* Sends a request on the query socket of a namespace and passes every reply
+   message to cb. Returns 0 on success and a negative error code otherwise. */
+static int rtnl_query(struct netns *ns, struct nlmsghdr *req, void (*cb)(const struct nlmsghdr *nh, void *arg), void *arg) {
+	static uint32_t seq;
+	uint8_t buffer[RTNL_BUFFER_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+	req->nlmsg_seq = ++seq;
+
+	if (send(ns->rtnl_query_sock, req, req->nlmsg_len, 0) < 0) {
+		warn_errno("send");
+		return -errno;
+	}
+
+	while (true) {
+		ssize_t len = recv(ns->rtnl_query_sock, buffer, sizeof(buffer), 0);
+		if (len < 0) {
+			int err = errno;
+			warn_error("recv", err);
+			return -err;
+		}
+
+		const struct nlmsghdr *nh;
+		for (nh = (struct nlmsghdr *)buffer; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+			if (nh->nlmsg_seq != req->nlmsg_seq)
+				continue;
+
+			switch (nh->nlmsg_type) {
+			case NLMSG_DONE:
+				return 0;
+
+			case NLMSG_ERROR:
+				return ((const struct nlmsgerr *)NLMSG_DATA(nh))->error;
+
+			default:
+				if (cb)
+					cb(nh, arg);
+
+				if (!(nh->nlmsg_flags & NLM_F_MULTI))
+					return 0;
+			}
+		}
+	}
+}
+
+static inline void rtnl_add_attr(struct nlmsghdr *nh, uint16_t type, const void *data, size_t len) {
+	struct rtattr *rta = (struct rtattr *)((uint8_t *)nh + NLMSG_ALIGN(nh->nlmsg_len));
+
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	memcpy(RTA_DATA(rta), data, len);
+
+	nh->nlmsg_len = NLMSG_ALIGN(nh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+
+struct link_info {
+	unsigned int ifindex;
+	const char *ifname;
+	const uint8_t *mac;
+	uint32_t mtu;
+};
+
+/* Parses a RTM_*LINK message; returns false if it is malformed */
+static bool parse_link(const struct nlmsghdr *nh, struct link_info *info) {
+	const struct ifinfomsg *msg = NLMSG_DATA(nh);
+	if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*msg)))
+		return false;
+
+	*info = (struct link_info){ .ifindex = msg->ifi_index };
+
+	int len = IFLA_PAYLOAD(nh);
+	const struct rtattr *rta;
+	for (rta = IFLA_RTA(msg); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case IFLA_IFNAME:
+			if (strnlen(RTA_DATA(rta), RTA_PAYLOAD(rta)) < RTA_PAYLOAD(rta))
+				info->ifname = RTA_DATA(rta);
+			break;
+
+		case IFLA_ADDRESS:
+			if (RTA_PAYLOAD(rta) >= 6)
+				info->mac = RTA_DATA(rta);
+			break;
+
+		case IFLA_MTU:
+			if (RTA_PAYLOAD(rta) >= sizeof(uint32_t))
+				memcpy(&info->mtu, RTA_DATA(rta), sizeof(uint32_t));
+		}
+	}
+
+	return info->ifindex && info->ifname;
+}
+
+struct addr_info {
+	unsigned int ifindex;
+	unsigned int prefixlen;
+	uint32_t flags;
+	uint8_t proto;
+	/* Remaining lifetimes in seconds, UINT32_MAX for infinity */
+	uint32_t valid;
+	uint32_t preferred;
+	const struct in6_addr *addr;
+};
+
+/* Addresses with these flags can't be used as the source of RAs (yet) */
+#define IFA_F_UNUSABLE (IFA_F_TENTATIVE | IFA_F_DADFAILED | IFA_F_OPTIMISTIC)
+
+/* Parses a RTM_*ADDR message; returns false if it is malformed or not about an IPv6 address */
+static bool parse_addr(const struct nlmsghdr *nh, struct addr_info *info) {
+	const struct ifaddrmsg *msg = NLMSG_DATA(nh);
+	if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*msg)))
+		return false;
+
+	if (msg->ifa_family != AF_INET6)
+		return false;
+
+	*info = (struct addr_info){
+		.ifindex = msg->ifa_index,
+		.prefixlen = msg->ifa_prefixlen,
+		.flags = msg->ifa_flags,
+		.valid = UINT32_MAX,
+		.preferred = UINT32_MAX,
+	};
+
+	int len = IFA_PAYLOAD(nh);
+	const struct rtattr *rta;
+	for (rta = IFA_RTA(msg); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		/* IFA_FLAGS supersedes the 8-bit ifa_flags */
+		if (rta->rta_type == IFA_FLAGS && RTA_PAYLOAD(rta) >= sizeof(uint32_t)) {
+			memcpy(&info->flags, RTA_DATA(rta), sizeof(uint32_t));
+			continue;
+		}
+
+#ifndef URADVD_STATIC
+		/* These are only needed to learn prefixes */
+		if (rta->rta_type == IFA_PROTO && RTA_PAYLOAD(rta) >= sizeof(uint8_t)) {
+			info->proto = *(const uint8_t *)RTA_DATA(rta);
+			continue;
+		}
+
+		if (rta->rta_type == IFA_CACHEINFO && RTA_PAYLOAD(rta) >= sizeof(struct ifa_cacheinfo)) {
+			struct ifa_cacheinfo ci;
+			memcpy(&ci, RTA_DATA(rta), sizeof(ci));
+
+			info->valid = ci.ifa_valid;
+			info->preferred = ci.ifa_prefered;
+			continue;
+		}
+#endif
+
+		if (RTA_PAYLOAD(rta) < sizeof(struct in6_addr))
+			continue;
+
+		/* IFA_LOCAL takes precedence over IFA_ADDRESS for point-to-point links */
+		if (rta->rta_type == IFA_LOCAL || (rta->rta_type == IFA_ADDRESS && !info->addr))
+			info->addr = RTA_DATA(rta);
+	}
+
+	return info->addr;
+}
+
+#ifndef URADVD_STATIC
+
+/* Checks if a prefix may be learned, i.e. if it is a global unicast prefix */
+static inline bool prefix_learnable(const struct in6_addr *prefix) {
+	return !IN6_IS_ADDR_UNSPECIFIED(prefix) && !IN6_IS_ADDR_LOOPBACK(prefix) &&
+		!IN6_IS_ADDR_LINKLOCAL(prefix) && !IN6_IS_ADDR_MULTICAST(prefix) && !IN6_IS_ADDR_V4MAPPED(prefix);
+}
+
+/* Checks if an address announces a prefix to learn. Temporary addresses and
+   addresses the kernel has autoconfigured from the RAs of other routers are
+   ignored; the latter are only recognized on Linux 6.3 and newer (IFA_PROTO). */
+static inline bool addr_learnable(const struct addr_info *info) {
+	return info->prefixlen == 64 && info->valid && prefix_learnable(info->addr) &&
+		!(info->flags & (IFA_F_TEMPORARY | IFA_F_DADFAILED)) && info->proto != IFAPROT_KERNEL_RA;
+}
+
+struct route_info {
+	unsigned int ifindex;
+	const struct in6_addr *dst;
+	/* Remaining lifetime in seconds, UINT32_MAX for infinity */
+	uint32_t expires;
+};
+
+/* Parses a RTM_*ROUTE message; returns false if it is malformed or not about
+   a directly connected /64 route of the main table to learn a prefix from */
+static bool parse_route(const struct nlmsghdr *nh, struct route_info *info) {
+	const struct rtmsg *msg = NLMSG_DATA(nh);
+	if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*msg)))
+		return false;
+
+	if (msg->rtm_family != AF_INET6 || msg->rtm_dst_len != 64 || msg->rtm_type != RTN_UNICAST)
+		return false;
+
+	/* Routes received from other routers are not passed on. The kernel's own
+	   prefix routes belong to addresses (which are learned directly) or to
+	   prefixes announced by other routers. */
+	if (msg->rtm_protocol == RTPROT_KERNEL || msg->rtm_protocol == RTPROT_RA || msg->rtm_protocol == RTPROT_REDIRECT)
+		return false;
+
+	*info = (struct route_info){ .expires = UINT32_MAX };
+	uint32_t table = msg->rtm_table;
+
+	int len = RTM_PAYLOAD(nh);
+	const struct rtattr *rta;
+	for (rta = RTM_RTA(msg); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case RTA_DST:
+			if (RTA_PAYLOAD(rta) >= sizeof(struct in6_addr))
+				info->dst = RTA_DATA(rta);
+			break;
+
+		case RTA_OIF:
+			if (RTA_PAYLOAD(rta) >= sizeof(uint32_t))
+				memcpy(&info->ifindex, RTA_DATA(rta), sizeof(uint32_t));
+			break;
+
+		case RTA_TABLE:
+			if (RTA_PAYLOAD(rta) >= sizeof(uint32_t))
+				memcpy(&table, RTA_DATA(rta), sizeof(uint32_t));
+			break;
+
+		case RTA_CACHEINFO:
+			if (RTA_PAYLOAD(rta) >= sizeof(struct rta_cacheinfo)) {
+				struct rta_cacheinfo ci;
+				memcpy(&ci, RTA_DATA(rta), sizeof(ci));
+
+				/* rta_expires is given in clock ticks */
+				if (ci.rta_expires)
+					info->expires = ci.rta_expires / sysconf(_SC_CLK_TCK);
+			}
+			break;
+
+		case RTA_GATEWAY:
+		case RTA_MULTIPATH:
+			return false;
+		}
+	}
+
+	return table == RT_TABLE_MAIN && info->ifindex && info->dst && prefix_learnable(info->dst);
+}
+
+#endif
+
+
+static inline unsigned int iface_hash(unsigned int ifindex) {
+	return ifindex % IFACE_HASH_SIZE;
+}
+
+static struct iface * get_iface(const struct netns *ns, unsigned int ifindex) {
+	struct iface *iface;
+
+	if (!ifindex)
+		return NULL;
+
+	for (iface = ns->iface_hash[iface_hash(ifindex)]; iface; iface = iface->hash_next) {
+		if (iface->ifindex == ifindex)
+			return iface;
+	}
+
+	return NULL;
+}
+
+static void iface_hash_remove(struct iface *iface) {
+	struct iface **cur;
+
+	if (!iface->ifindex)
+		return;
+
+	for (cur = &iface->netns->iface_hash[iface_hash(iface->ifindex)]; *cur; cur = &(*cur)->hash_next) {
+		if (*cur == iface) {
+			*cur = iface->hash_next;
+			break;
+		}
+	}
+
+	iface->hash_next = NULL;
+}
+
+static void iface_hash_add(struct iface *iface) {
+	struct iface **bucket = &iface->netns->iface_hash[iface_hash(iface->ifindex)];
+
+	iface->hash_next = *bucket;
+	*bucket = iface;
+}
+
+/* Returns the namespace of the given name (NULL for the initial one), which
+   is added when it isn't known yet */
+static struct netns * get_netns(const char *name) {
+	struct netns *ns, **tail;
+
+	for (tail = &G.netns; *tail; tail = &(*tail)->next) {
+		ns = *tail;
+
+		if (!ns->name && !name)
+			return ns;
+		if (ns->name && name && strcmp(ns->name, name) == 0)
+			return ns;
+	}
+
+	ns = calloc(1, sizeof(*ns));
+	if (!ns)
+		exit_errno("calloc");
+
+	ns->name = name;
+	ns->icmp_sock = -1;
+	ns->rtnl_sock = -1;
+	ns->rtnl_query_sock = -1;
+
+	*tail = ns;
+
+	return ns;
+}
+
+/* Adds an interface given as [<netns>/]<ifname> */
+static struct iface * add_iface(const char *name) {
+	struct iface *iface, **tail;
+	struct netns *ns = NULL;
+	const char *ifname = name;
+
+#ifndef URADVD_STATIC
+	const char *slash = strchr(name, '/');
+	if (slash) {
+		char *ns_name = strndup(name, slash - name);
+		if (!ns_name)
+			exit_errno("strndup");
+
+		ifname = slash + 1;
+
+		if (!*ns_name)
+			exit_error_name("invalid network namespace in", name, 0);
+
+		ns = get_netns(ns_name);
+		if (ns->name != ns_name)
+			free(ns_name);
+	}
+	else {
+		ns = get_netns(NULL);
+	}
+
+	if (!*ifname || strlen(ifname) >= IFNAMSIZ || strchr(ifname, '/'))
+		exit_error_name("invalid interface name", name, 0);
+
+	for (tail = &G.ifaces; *tail; tail = &(*tail)->next) {
+		if ((*tail)->netns == ns && strcmp((*tail)->ifname, ifname) == 0)
+			exit_error_name("interface given more than once:", name, 0);
+	}
+#else
+	/* ra-template has checked the single interface name */
+	ns = get_netns(NULL);
+	tail = &G.ifaces;
+#endif
+
+	iface = calloc(1, sizeof(*iface));
+	if (!iface)
+		exit_errno("calloc");
+
+	iface->netns = ns;
+	iface->name = name;
+	iface->ifname = ifname;
+
+	*tail = iface;
+	G.n_ifaces++;
+
+	return iface;
+}
+
+
+/* Drops the cached RA, so it is rebuilt before it is sent the next time */
+static inline void invalidate_advert(struct iface *iface) {
+	iface->n_ra = 0;
+	iface->n_ra_sent = 0;
+}
+
+static void schedule_advert(struct iface *iface, bool nodelay) {
+	struct rs_aggregate *aggregate = &iface->rs_aggregate;
+	uint64_t t = G.now;
+	bool postpone = false;
+
+	if (nodelay) {
+#ifndef URADVD_STATIC
+		if (G.storm_threshold && aggregate->count >= G.storm_threshold) {
+			/* Batch the storm into a single RA; the window starts with the first
+			   solicitation, so the ones received early don't wait indefinitely */
+			t = aggregate->first + random_delay(G.ra_delay, G.ra_delay_storm) * NSEC_PER_MSEC;
+			postpone = !aggregate->storm;
+			aggregate->storm = true;
+		}
+		else
+#endif
+		{
+			t += random_delay(0, aggregate->count > 1 ? G.ra_delay : G.ra_delay_single) * NSEC_PER_MSEC;
+		}
+	}
+	else {
+		/* Uniformly distributed as in RFC 4861, section 6.2.4, with ra_interval
+		   in place of MaxRtrAdvInterval */
+		uint64_t delay = random_delay(iface->conf.min_ra_interval * 1000u, iface->ra_interval);
+
+		/* RFC 4861, section 6.2.4 */
+		if (iface->initial_adverts && delay > G.initial_interval)
+			delay = G.initial_interval;
+
+		t += delay * NSEC_PER_MSEC;
+	}
+
+	if (iface->next_advert_earliest > t) {
+#ifndef URADVD_STATIC
+		if (nodelay && aggregate->count && !aggregate->clamped) {
+			aggregate->clamped = true;
+			aggregate->clamp_delay = iface->next_advert_earliest - t;
+		}
+#endif
+
+		t = iface->next_advert_earliest;
+	}
+
+	struct timer *timer = &iface->advert_timer;
+	if (!nodelay || !timer_pending(timer) || timer->deadline > t || postpone)
+		timer_set(timer, t);
+}
+
+/* Starts a new burst of initial RAs when an interface (re)appears. The first
+   one is sent right away. */
+static void start_initial_adverts(struct iface *iface) {
+	iface->initial_adverts = G.initial_adverts;
+	iface->n_ra_sent = 0;
+
+	struct timer *timer = &iface->advert_timer;
+	uint64_t t = iface->next_advert_earliest > G.now ? iface->next_advert_earliest : G.now;
+
+	if (!timer_pending(timer) || timer->deadline > t)
+		timer_set(timer, t);
+}
+
+
+#ifndef URADVD_STATIC
+
+/* The content of the static build is fixed by its RA template, so it has no
+   content changes, learned prefixes or withdrawals */
+
+/* Applies a change of an interface's RA content. A single unsolicited RA is
+   sent after the random delay of solicited RAs, which lets changes made in
+   quick succession coalesce into it. */
+static void config_changed(struct iface *iface) {
+	invalidate_advert(iface);
+
+	if (iface->ok && !G.shutdown)
+		schedule_advert(iface, true);
+}
+
+/* Announces a removed prefix or RDNSS server with lifetime 0 in the next RAs */
+static void withdraw(struct iface *iface, bool rdnss, const struct in6_addr *addr, bool onlink) {
+	struct withdrawal *w = NULL;
+	size_t i;
+
+	for (i = 0; i < iface->n_withdrawn; i++) {
+		if (iface->withdrawn[i].rdnss == rdnss && IN6_ARE_ADDR_EQUAL(&iface->withdrawn[i].addr, addr))
+			w = &iface->withdrawn[i];
+	}
+
+	if (!w) {
+		iface->withdrawn = array_grow(iface->withdrawn, iface->n_withdrawn, &iface->withdrawn_size, sizeof(*iface->withdrawn));
+		w = &iface->withdrawn[iface->n_withdrawn++];
+	}
+
+	*w = (struct withdrawal){
+		.rdnss = rdnss,
+		.onlink = onlink,
+		.addr = *addr,
+		.adverts = G.initial_adverts ? G.initial_adverts : 1,
+	};
+}
+
+/* Stops announcing a withdrawal when the prefix or server is added again */
+static void unwithdraw(struct iface *iface, bool rdnss, const struct in6_addr *addr) {
+	size_t i;
+
+	for (i = 0; i < iface->n_withdrawn; i++) {
+		struct withdrawal *w = &iface->withdrawn[i];
+
+		if (w->rdnss == rdnss && IN6_ARE_ADDR_EQUAL(&w->addr, addr)) {
+			memmove(w, w+1, (--iface->n_withdrawn - i) * sizeof(*w));
+			return;
+		}
+	}
+}
+
+static ssize_t find_prefix(const struct config *conf, const struct in6_addr *prefix) {
+	size_t i;
+
+	for (i = 0; i < conf->n_prefixes; i++) {
+		if (IN6_ARE_ADDR_EQUAL(&conf->prefixes[i].addr, prefix))
+			return i;
+	}
+
+	return -1;
+}
+
+static struct prefix * config_add_prefix(struct config *conf, const struct in6_addr *addr, bool onlink, uint8_t source) {
+	conf->prefixes = array_grow(conf->prefixes, conf->n_prefixes, &conf->prefixes_size, sizeof(*conf->prefixes));
+
+	struct prefix *prefix = &conf->prefixes[conf->n_prefixes++];
+	*prefix = (struct prefix){
+		.addr = *addr,
+		.onlink = onlink,
+		.source = source,
+	};
+
+	return prefix;
+}
+
+static void config_del_prefix(struct config *conf, size_t i) {
+	conf->n_prefixes--;
+	memmove(&conf->prefixes[i], &conf->prefixes[i+1], (conf->n_prefixes - i) * sizeof(conf->prefixes[0]));
+}
+
+/* RDNSS servers are only configured on the command line and through the control socket */
+static ssize_t find_rdnss(const struct config *conf, const struct in6_addr *addr) {
+	size_t i;
+
+	for (i = 0; i < conf->n_rdnss; i++) {
+		if (IN6_ARE_ADDR_EQUAL(&conf->rdnss[i], addr))
+			return i;
+	}
+
+	return -1;
+}
+
+static void config_add_rdnss(struct config *conf, const struct in6_addr *addr) {
+	conf->rdnss = array_grow(conf->rdnss, conf->n_rdnss, &conf->rdnss_size, sizeof(*conf->rdnss));
+	conf->rdnss[conf->n_rdnss++] = *addr;
+}
+
+/* Removes a prefix from the RAs of an interface, announcing it with lifetime 0 for a while */
+static void remove_prefix(struct iface *iface, size_t i) {
+	struct config *conf = &iface->conf;
+
+	withdraw(iface, false, &conf->prefixes[i].addr, conf->prefixes[i].onlink);
+	config_del_prefix(conf, i);
+}
+
+/* Converts a lifetime in seconds as used by the kernel into an expiry time (0 for infinity) */
+static inline uint64_t expiry_time(uint32_t lifetime) {
+	return lifetime == UINT32_MAX ? 0 : G.now + lifetime * NSEC_PER_SEC;
+}
+
+/* Returns the later of two expiry times */
+static inline uint64_t expiry_max(uint64_t a, uint64_t b) {
+	if (!a || !b)
+		return 0;
+
+	return a > b ? a : b;
+}
+
+/* Returns the lifetime to advertise for an expiry time, which is at most max */
+static inline uint32_t expiry_remaining(uint64_t until, uint32_t max) {
+	if (!until)
+		return max;
+
+	if (until <= G.now)
+		return 0;
+
+	uint64_t remaining = (until - G.now) / NSEC_PER_SEC;
+	return remaining < max ? remaining : max;
+}
+
+static inline uint32_t prefix_valid_lifetime(const struct prefix *prefix) {
+	return expiry_remaining(prefix->valid_until, AdvValidLifetime);
+}
+
+/* On shutdown, prefixes are deprecated */
+static inline uint32_t prefix_preferred_lifetime(const struct prefix *prefix) {
+	uint32_t preferred = G.shutdown ? 0 : expiry_remaining(prefix->preferred_until, AdvPreferredLifetime);
+	uint32_t valid = prefix_valid_lifetime(prefix);
+
+	return preferred < valid ? preferred : valid;
+}
+
+static struct prefix * prefix_set_find(const struct prefix_set *set, const struct in6_addr *prefix) {
+	size_t i;
+
+	for (i = 0; i < set->n; i++) {
+		if (IN6_ARE_ADDR_EQUAL(&set->prefixes[i].addr, prefix))
+			return &set->prefixes[i];
+	}
+
+	return NULL;
+}
+
+/* Adds the /64 prefix of an address to a set. When it is found more than
+   once, the longest lifetimes apply. */
+static void prefix_set_add(struct prefix_set *set, const struct in6_addr *addr, uint64_t valid_until, uint64_t preferred_until) {
+	struct in6_addr prefix = *addr;
+	memset(&prefix.s6_addr[8], 0, 8);
+
+	struct prefix *entry = prefix_set_find(set, &prefix);
+	if (entry) {
+		entry->valid_until = expiry_max(entry->valid_until, valid_until);
+		entry->preferred_until = expiry_max(entry->preferred_until, preferred_until);
+		return;
+	}
+
+	set->prefixes = array_grow(set->prefixes, set->n, &set->size, sizeof(*set->prefixes));
+	set->prefixes[set->n++] = (struct prefix){
+		.addr = prefix,
+		.valid_until = valid_until,
+		.preferred_until = preferred_until,
+	};
+}
+
+/* Replaces the content of a set with another one, which is moved */
+static void prefix_set_move(struct prefix_set *set, struct prefix_set *from) {
+	free(set->prefixes);
+	*set = *from;
+	*from = (struct prefix_set){};
+}
+
+/* Applies the prefixes currently found in the addresses and routes of an
+   interface. Only the differences to the advertised set are applied, and the
+   RA is only sent right away when a prefix is actually added or removed;
+   statically configured prefixes are never removed, and keep their own
+   lifetimes. */
+static void learn_prefixes(struct iface *iface) {
+	struct config *conf = &iface->conf;
+	struct prefix_set learned = {};
+	bool changed = false;
+	size_t i;
+
+	for (i = 0; i < iface->addr_prefixes.n; i++) {
+		const struct prefix *p = &iface->addr_prefixes.prefixes[i];
+		prefix_set_add(&learned, &p->addr, p->valid_until, p->preferred_until);
+	}
+	for (i = 0; i < iface->route_prefixes.n; i++) {
+		const struct prefix *p = &iface->route_prefixes.prefixes[i];
+		prefix_set_add(&learned, &p->addr, p->valid_until, p->preferred_until);
+	}
+
+	for (i = conf->n_prefixes; i-- > 0;) {
+		struct prefix *prefix = &conf->prefixes[i];
+
+		if (!(prefix->source & PREFIX_LEARNED) || prefix_set_find(&learned, &prefix->addr))
+			continue;
+
+		prefix->source &= ~PREFIX_LEARNED;
+		if (!prefix->source) {
+			remove_prefix(iface, i);
+			changed = true;
+		}
+	}
+
+	for (i = 0; i < learned.n; i++) {
+		const struct prefix *l = &learned.prefixes[i];
+		struct prefix *prefix;
+		ssize_t j = find_prefix(conf, &l->addr);
+
+		if (j >= 0) {
+			prefix = &conf->prefixes[j];
+			prefix->source |= PREFIX_LEARNED;
+
+			if (prefix->source & PREFIX_STATIC)
+				continue;
+		}
+		else {
+			prefix = config_add_prefix(conf, &l->addr, conf->learn_prefixes == LEARN_ONLINK, PREFIX_LEARNED);
+			unwithdraw(iface, false, &l->addr);
+			changed = true;
+		}
+
+		/* Changed lifetimes are patched into the cached RA and don't need an RA of their own */
+		prefix->valid_until = l->valid_until;
+		prefix->preferred_until = l->preferred_until;
+	}
+
+	free(learned.prefixes);
+
+	if (changed)
+		config_changed(iface);
+}
+
+#endif
+
+static const struct in6_addr all_routers = {
+	.s6_addr = {
+		0xff, 0x02, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x02,
+	}
+};
+
+static int join_multicast(struct iface *iface) {
+	struct ipv6_mreq mreq = {
+		.ipv6mr_multiaddr = all_routers,
+		.ipv6mr_interface = iface->ifindex,
+	};
+
+	if (setsockopt(iface->netns->icmp_sock, IPPROTO_IPV6, IPV6_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == 0) {
+		return 2;
+	}
+	else if (errno != EADDRINUSE) {
+		warn_errno("can't join multicast group");
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Drops the membership of the all-routers group on the interface's current
+   ifindex. Otherwise it would stay on the socket after the interface has
+   disappeared or was renamed, and a later join on a device reusing the ifindex
+   would fail with EADDRINUSE without having joined the group on it. */
+static void leave_multicast(struct iface *iface) {
+	struct ipv6_mreq mreq = {
+		.ipv6mr_multiaddr = all_routers,
+		.ipv6mr_interface = iface->ifindex,
+	};
+
+	/* EADDRNOTAVAIL: the group hasn't been joined on this ifindex */
+	if (setsockopt(iface->netns->icmp_sock, IPPROTO_IPV6, IPV6_DROP_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 && errno != EADDRNOTAVAIL)
+		warn_errno("can't leave multicast group");
+}
+
+static void iface_set_ifindex(struct iface *iface, unsigned int ifindex) {
+	if (iface->ifindex == ifindex)
+		return;
+
+	if (iface->ifindex)
+		leave_multicast(iface);
+
+	iface_hash_remove(iface);
+	iface->ifindex = ifindex;
+	if (ifindex)
+		iface_hash_add(iface);
+
+	update_icmp_filter(iface->netns);
+	update_rtnl_filter(iface->netns);
+
+	iface->changed = true;
+}
+
+static void iface_set_mac(struct iface *iface, const uint8_t *mac) {
+	static const uint8_t zero[6] = {};
+
+	if (!mac)
+		mac = zero;
+
+	if (memcmp(iface->mac, mac, sizeof(iface->mac)) == 0)
+		return;
+
+	memcpy(iface->mac, mac, sizeof(iface->mac));
+	invalidate_advert(iface);
+
+	iface->changed = true;
+}
+
+#ifndef URADVD_STATIC
+
+/* The templates of the static build carry no MTU option, so it doesn't track the MTU */
+static void iface_set_mtu(struct iface *iface, uint32_t mtu) {
+	if (iface->mtu == mtu)
+		return;
+
+	iface->mtu = mtu;
+	invalidate_advert(iface);
+
+	iface->changed = true;
+}
+
+#endif
+
+static void iface_set_ifaddr(struct iface *iface, const struct in6_addr *addr) {
+	if (!addr)
+		addr = &in6addr_any;
+
+	if (IN6_ARE_ADDR_EQUAL(&iface->ifaddr, addr))
+		return;
+
+	iface->ifaddr = *addr;
+	iface->changed = true;
+}
+
+static void iface_set_link(struct iface *iface, const struct link_info *info) {
+	iface_set_ifindex(iface, info ? info->ifindex : 0);
+	iface_set_mac(iface, info ? info->mac : NULL);
+#ifndef URADVD_STATIC
+	iface_set_mtu(iface, info ? info->mtu : 0);
+#endif
+}
+
+static void query_link_cb(const struct nlmsghdr *nh, void *arg) {
+	struct link_info info;
+
+	if (nh->nlmsg_type != RTM_NEWLINK || !parse_link(nh, &info))
+		return;
+
+	if (strcmp(info.ifname, ((struct iface *)arg)->ifname) == 0)
+		iface_set_link(arg, &info);
+}
+
+/* Looks up an interface's ifindex and MAC address by name */
+static void query_link(struct iface *iface) {
+	struct {
+		struct nlmsghdr nh;
+		struct ifinfomsg msg;
+		uint8_t attrs[RTA_SPACE(IFNAMSIZ)];
+	} req = {
+		.nh = {
+			.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+			.nlmsg_type = RTM_GETLINK,
+			.nlmsg_flags = NLM_F_REQUEST,
+		},
+		.msg = {
+			.ifi_family = AF_UNSPEC,
+		},
+	};
+
+	rtnl_add_attr(&req.nh, IFLA_IFNAME, iface->ifname, strnlen(iface->ifname, IFNAMSIZ-1) + 1);
+
+	iface_set_link(iface, NULL);
+	rtnl_query(iface->netns, &req.nh, query_link_cb, iface);
+}
+
+struct query_addrs_state {
+	struct iface *iface;
+	bool found_current;
+	struct in6_addr candidate;
+#ifndef URADVD_STATIC
+	struct prefix_set prefixes;
+#endif
+};
+
+static void query_addrs_cb(const struct nlmsghdr *nh, void *arg) {
+	struct query_addrs_state *state = arg;
+	struct addr_info info;
+
+	if (nh->nlmsg_type != RTM_NEWADDR || !parse_addr(nh, &info))
+		return;
+
+	if (info.ifindex != state->iface->ifindex)
+		return;
+
+	if (!IN6_IS_ADDR_LINKLOCAL(info.addr)) {
+#ifndef URADVD_STATIC
+		if (state->iface->conf.learn_prefixes && addr_learnable(&info))
+			prefix_set_add(&state->prefixes, info.addr, expiry_time(info.valid), expiry_time(info.preferred));
+#endif
+
+		return;
+	}
+
+	if (info.flags & IFA_F_UNUSABLE)
+		return;
+
+	if (IN6_ARE_ADDR_EQUAL(info.addr, &state->iface->ifaddr))
+		state->found_current = true;
+	else if (IN6_IS_ADDR_UNSPECIFIED(&state->candidate))
+		state->candidate = *info.addr;
+}
+
+/* Selects a usable link-local address from a dump of the addresses of a single
+   interface. The current address is kept as long as it is still usable. When
+   prefixes are learned, the prefixes of the global addresses are collected as well. */
+static void query_addrs(struct iface *iface) {
+	struct query_addrs_state state = { .iface = iface };
+
+	struct {
+		struct nlmsghdr nh;
+		struct ifaddrmsg msg;
+	} req = {
+		.nh = {
+			.nlmsg_len = sizeof(req),
+			.nlmsg_type = RTM_GETADDR,
+			.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+		},
+		.msg = {
+			.ifa_family = AF_INET6,
+			.ifa_index = iface->ifindex,
+		},
+	};
+
+	if (!iface->ifindex) {
+		iface_set_ifaddr(iface, NULL);
+#ifndef URADVD_STATIC
+		iface->addr_prefixes.n = 0;
+#endif
+		return;
+	}
+
+	int err = rtnl_query(iface->netns, &req.nh, query_addrs_cb, &state);
+	if (err) {
+		warn_error("can't dump addresses", -err);
+#ifndef URADVD_STATIC
+		free(state.prefixes.prefixes);
+#endif
+		return;
+	}
+
+	if (!state.found_current)
+		iface_set_ifaddr(iface, &state.candidate);
+
+#ifndef URADVD_STATIC
+	prefix_set_move(&iface->addr_prefixes, &state.prefixes);
+#endif
+}
+
+#ifndef URADVD_STATIC
+
+struct query_routes_state {
+	const struct iface *iface;
+	struct prefix_set prefixes;
+};
+
+static void query_routes_cb(const struct nlmsghdr *nh, void *arg) {
+	struct query_routes_state *state = arg;
+	struct route_info info;
+
+	if (nh->nlmsg_type != RTM_NEWROUTE || !parse_route(nh, &info))
+		return;
+
+	if (info.ifindex == state->iface->ifindex)
+		prefix_set_add(&state->prefixes, info.dst, expiry_time(info.expires), expiry_time(info.expires));
+}
+
+/* Collects the prefixes of the /64 routes of an interface */
+static void query_routes(struct iface *iface) {
+	struct query_routes_state state = { .iface = iface };
+
+	struct {
+		struct nlmsghdr nh;
+		struct rtmsg msg;
+		uint8_t attrs[RTA_SPACE(sizeof(uint32_t))];
+	} req = {
+		.nh = {
+			.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg)),
+			.nlmsg_type = RTM_GETROUTE,
+			.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+		},
+		.msg = {
+			.rtm_family = AF_INET6,
+			.rtm_table = RT_TABLE_MAIN,
+		},
+	};
+
+	if (!iface->ifindex) {
+		iface->route_prefixes.n = 0;
+		return;
+	}
+
+	/* With strict checking, the kernel only dumps the routes of the interface */
+	uint32_t oif = iface->ifindex;
+	rtnl_add_attr(&req.nh, RTA_OIF, &oif, sizeof(oif));
+
+	int err = rtnl_query(iface->netns, &req.nh, query_routes_cb, &state);
+	if (err) {
+		warn_error("can't dump routes", -err);
+		free(state.prefixes.prefixes);
+		return;
+	}
+
+	prefix_set_move(&iface->route_prefixes, &state.prefixes);
+}
+
+#endif
+
+/* Brings an interface's advertisement state in line with its link state */
+static void update_interface(struct iface *iface) {
+	iface->ok = false;
+
+	if (!iface->ifindex || IN6_IS_ADDR_UNSPECIFIED(&iface->ifaddr))
+		return;
+
+	int joined = join_multicast(iface);
+	if (!joined)
+		return;
+
+	iface->ok = true;
+
+	if (G.shutdown)
+		return;
+
+	if (iface->changed || joined == 2 || !timer_pending(&iface->advert_timer))
+		start_initial_adverts(iface);
+
+	iface->changed = false;
+}
+
+
+static struct iface * get_iface_by_name(const struct netns *ns, const char *ifname) {
+	struct iface *iface;
+
+	for_each_iface(iface) {
+		if (iface->netns == ns && strcmp(iface->ifname, ifname) == 0)
+			return iface;
+	}
+
+	return NULL;
+}
+
+/* Marks an interface to be refreshed when the coalescing window has passed */
+static void mark_dirty(struct iface *iface, unsigned int flags) {
+	iface->dirty |= DIRTY_STATE | flags;
+
+	if (!timer_pending(&G.refresh_timer))
+		timer_set_in(&G.refresh_timer, G.refresh_delay);
+}
+
+/* Looks up the state of an interface at startup. Only the link and its
+   addresses, which give the ifindex, MAC and link-local address needed for
+   the first RA, are queried right away; the routes to learn prefixes from
+   follow in the first refresh. */
+static void start_interface(struct iface *iface) {
+	query_link(iface);
+	query_addrs(iface);
+
+#ifndef URADVD_STATIC
+	if (iface->conf.learn_prefixes) {
+		learn_prefixes(iface);
+		mark_dirty(iface, DIRTY_ROUTES);
+	}
+#endif
+
+	update_interface(iface);
+}
+
+static void refresh_dirty_interfaces(struct timer *timer __attribute__((unused))) {
+	struct iface *iface;
+
+	for_each_iface(iface) {
+		if (!iface->dirty)
+			continue;
+
+		if (iface->dirty & DIRTY_LINK) {
+			unsigned int ifindex = iface->ifindex;
+
+			query_link(iface);
+			if (iface->ifindex != ifindex)
+				iface_set_ifaddr(iface, NULL);
+		}
+
+		if (iface->dirty & (DIRTY_LINK|DIRTY_ADDRS))
+			query_addrs(iface);
+
+#ifndef URADVD_STATIC
+		if (iface->conf.learn_prefixes && (iface->dirty & (DIRTY_LINK|DIRTY_ADDRS|DIRTY_ROUTES))) {
+			if (iface->dirty & (DIRTY_LINK|DIRTY_ROUTES))
+				query_routes(iface);
+
+			learn_prefixes(iface);
+		}
+#endif
+
+		update_interface(iface);
+
+		iface->dirty = 0;
+	}
+}
+
+/* Events have been lost, so the state of all interfaces of the namespace is looked up again */
+static void resync_interfaces(const struct netns *ns) {
+	struct iface *iface;
+
+	for_each_iface(iface) {
+		if (iface->netns == ns)
+			mark_dirty(iface, DIRTY_LINK|DIRTY_ADDRS);
+	}
+}
+
+/* Forgets the link state of an interface that has disappeared or was renamed */
+static void iface_lost(struct iface *iface) {
+	iface_set_link(iface, NULL);
+	iface_set_ifaddr(iface, NULL);
+	iface->ok = false;
+
+	mark_dirty(iface, 0);
+}
+
+static void handle_rtnl_link(struct netns *ns, const struct nlmsghdr *nh) {
+	struct link_info info;
+	if (!parse_link(nh, &info))
+		return;
+
+	struct iface *iface = get_iface(ns, info.ifindex);
+
+	if (nh->nlmsg_type == RTM_DELLINK) {
+		if (iface)
+			iface_lost(iface);
+
+		return;
+	}
+
+	/* The interface has been renamed */
+	if (iface && strcmp(iface->ifname, info.ifname) != 0)
+		iface_lost(iface);
+
+	iface = get_iface_by_name(ns, info.ifname);
+	if (!iface)
+		return;
+
+	bool new_index = (iface->ifindex != info.ifindex);
+	iface_set_link(iface, &info);
+
+	/* The addresses are only unknown when the interface has just (re-)appeared */
+	if (new_index)
+		iface_set_ifaddr(iface, NULL);
+
+	mark_dirty(iface, new_index ? DIRTY_ADDRS : 0);
+}
+
+static void handle_rtnl_addr(struct netns *ns, const struct nlmsghdr *nh) {
+	struct addr_info info;
+	if (!parse_addr(nh, &info))
+		return;
+
+	struct iface *iface = get_iface(ns, info.ifindex);
+	if (!iface)
+		return;
+
+	if (!IN6_IS_ADDR_LINKLOCAL(info.addr)) {
+#ifndef URADVD_STATIC
+		if (iface->conf.learn_prefixes && info.prefixlen == 64)
+			mark_dirty(iface, DIRTY_ADDRS);
+#endif
+
+		return;
+	}
+
+	bool usable = !(info.flags & IFA_F_UNUSABLE);
+
+	switch (nh->nlmsg_type) {
+	case RTM_NEWADDR:
+		if (usable) {
+			if (!IN6_IS_ADDR_UNSPECIFIED(&iface->ifaddr))
+				return;
+
+			/* DAD has just completed, or a usable address has been added: start
+			   advertising right away instead of waiting for the coalescing window */
+			iface_set_ifaddr(iface, info.addr);
+			update_interface(iface);
+			return;
+		}
+
+		/* The current address has become unusable, e.g. because DAD has failed or restarted */
+		/* fall through */
+
+	case RTM_DELADDR:
+		if (!IN6_ARE_ADDR_EQUAL(&iface->ifaddr, info.addr))
+			return;
+
+		/* Stop sending from the removed address right away */
+		iface_set_ifaddr(iface, NULL);
+		iface->ok = false;
+		mark_dirty(iface, DIRTY_ADDRS);
+	}
+}
+
+#ifndef URADVD_STATIC
+
+static void handle_rtnl_route(struct netns *ns, const struct nlmsghdr *nh) {
+	struct route_info info;
+	if (!parse_route(nh, &info))
+		return;
+
+	struct iface *iface = get_iface(ns, info.ifindex);
+	if (iface && iface->conf.learn_prefixes)
+		mark_dirty(iface, DIRTY_ROUTES);
+}
+
+#endif
+
+static void handle_rtnl_msg(struct netns *ns, const struct nlmsghdr *nh) {
+	switch (nh->nlmsg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+	case RTM_SETLINK:
+		handle_rtnl_link(ns, nh);
+		break;
+
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+		handle_rtnl_addr(ns, nh);
+		break;
+
+#ifndef URADVD_STATIC
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE:
+		handle_rtnl_route(ns, nh);
+#endif
+	}
+}
+
+/* Drains the RTNL event socket. The messages only update the known state
+   and mark interfaces dirty; the resulting refresh happens once per
+   coalescing window in refresh_dirty_interfaces(). */
+static void handle_rtnl(struct watch *watch) {
+	struct netns *ns = container_of(watch, struct netns, rtnl_watch);
+	static uint8_t buffer[RTNL_BUFFER_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+	while (true) {
+		ssize_t len = recv(watch->fd, buffer, sizeof(buffer), 0);
+		if (len < 0) {
+			if (errno == ENOBUFS) {
+				/* The socket has overrun; continue draining, but don't
+				   trust the state we have built from events so far */
+				warn_error("RTNL socket overrun, resynchronizing", 0);
+				resync_interfaces(ns);
+				continue;
+			}
+
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				warn_errno("recv");
+
+			return;
+		}
+
+		const struct nlmsghdr *nh;
+		for (nh = (struct nlmsghdr *)buffer; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+			if (nh->nlmsg_type == NLMSG_DONE)
+				break;
+
+			if (nh->nlmsg_type == NLMSG_ERROR) {
+				const struct nlmsgerr *err = NLMSG_DATA(nh);
+				if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*err))) {
+					warn_error("netlink error", 0);
+					continue;
+				}
+
+				/* Neighbour entries from add_neighbour() that exist already are left alone */
+				if (err->error == -EEXIST && err->msg.nlmsg_type == RTM_NEWNEIGH)
+					continue;
+
+				warn_error("netlink error", -err->error);
+				continue;
+			}
+
+			handle_rtnl_msg(ns, nh);
+		}
+	}
+}
+
+static void add_pktinfo(const struct iface *iface, struct msghdr *msg) {
+	struct cmsghdr *cmsg = (struct cmsghdr*)((char*)msg->msg_control + msg->msg_controllen);
+
+	cmsg->cmsg_level = IPPROTO_IPV6;
+	cmsg->cmsg_type = IPV6_PKTINFO;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
+
+	msg->msg_controllen += cmsg->cmsg_len;
+
+	struct in6_pktinfo pktinfo = {
+		.ipi6_addr = iface->ifaddr,
+		.ipi6_ifindex = iface->ifindex,
+	};
+
+	memcpy(CMSG_DATA(cmsg), &pktinfo, sizeof(pktinfo));
+}
+
+
+/* Returns the data of an IPPROTO_IPV6 control message of a received packet, or NULL */
+static const void * get_cmsg(const struct msghdr *msg, int type) {
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR((struct msghdr *)msg, cmsg)) {
+		if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == type)
+			return CMSG_DATA(cmsg);
+	}
+
+	return NULL;
+}
+
+static int get_hoplimit(const struct msghdr *msg) {
+	const int *hoplimit = get_cmsg(msg, IPV6_HOPLIMIT);
+	return hoplimit ? *hoplimit : RS_HOPLIMIT_UNKNOWN;
+}
+
+/* Checks if a received packet is a valid router solicitation */
+static enum rs_status check_solicit(const struct msghdr *msg, const uint8_t *buffer, size_t len) {
+	const struct sockaddr_in6 *addr = msg->msg_name;
+
+	return rs_validate(buffer, len, get_hoplimit(msg), &addr->sin6_addr);
+}
+
+#ifndef URADVD_STATIC
+
+/* The static build only limits solicitations per interface */
+static void init_sources(void) {
+	struct source_table *table = &sources;
+	size_t i;
+
+	table->seed = random();
+
+	for (i = 0; i < SOURCE_HASH_SIZE; i++)
+		table->hash[i] = NO_SOURCE;
+
+	for (i = 0; i < SOURCE_TABLE_SIZE; i++) {
+		table->entries[i].hash_next = NO_SOURCE;
+		table->entries[i].lru_prev = i ? i-1 : NO_SOURCE;
+		table->entries[i].lru_next = (i < SOURCE_TABLE_SIZE-1) ? i+1 : NO_SOURCE;
+	}
+
+	table->lru_head = 0;
+	table->lru_tail = SOURCE_TABLE_SIZE-1;
+}
+
+/* The seed keeps sources from choosing addresses that collide in the hash table */
+static inline unsigned int source_hash(const struct in6_addr *addr, const struct iface *iface) {
+	uint32_t words[4], h = sources.seed ^ (uint32_t)((uintptr_t)iface / sizeof(*iface));
+	size_t i;
+
+	memcpy(words, addr->s6_addr, sizeof(words));
+	for (i = 0; i < 4; i++)
+		h = (h ^ words[i]) * 0x9e3779b1u;
+
+	return (h >> 16) % SOURCE_HASH_SIZE;
+}
+
+static void source_lru_unlink(struct source_table *table, uint16_t index) {
+	struct source_entry *entry = &table->entries[index];
+
+	if (entry->lru_prev != NO_SOURCE)
+		table->entries[entry->lru_prev].lru_next = entry->lru_next;
+	else
+		table->lru_head = entry->lru_next;
+
+	if (entry->lru_next != NO_SOURCE)
+		table->entries[entry->lru_next].lru_prev = entry->lru_prev;
+	else
+		table->lru_tail = entry->lru_prev;
+}
+
+static void source_lru_push(struct source_table *table, uint16_t index) {
+	struct source_entry *entry = &table->entries[index];
+
+	entry->lru_prev = NO_SOURCE;
+	entry->lru_next = table->lru_head;
+
+	if (table->lru_head != NO_SOURCE)
+		table->entries[table->lru_head].lru_prev = index;
+	else
+		table->lru_tail = index;
+
+	table->lru_head = index;
+}
+
+static void source_hash_remove(struct source_table *table, uint16_t index) {
+	struct source_entry *entry = &table->entries[index];
+	uint16_t *slot = &table->hash[source_hash(&entry->addr, entry->iface)];
+
+	while (*slot != index)
+		slot = &table->entries[*slot].hash_next;
+
+	*slot = entry->hash_next;
+}
+
+/* Returns the rate limiting state of a source, evicting the least recently used one if it is unknown */
+static struct source_entry * get_source(const struct in6_addr *addr, const struct iface *iface) {
+	struct source_table *table = &sources;
+	unsigned int hash = source_hash(addr, iface);
+	uint16_t index;
+
+	for (index = table->hash[hash]; index != NO_SOURCE; index = table->entries[index].hash_next) {
+		const struct source_entry *entry = &table->entries[index];
+
+		if (entry->iface == iface && IN6_ARE_ADDR_EQUAL(&entry->addr, addr))
+			break;
+	}
+
+	if (index == NO_SOURCE) {
+		index = table->lru_tail;
+
+		struct source_entry *entry = &table->entries[index];
+		if (entry->iface)
+			source_hash_remove(table, index);
+
+		entry->addr = *addr;
+		entry->iface = iface;
+		entry->tat = 0;
+
+		entry->hash_next = table->hash[hash];
+		table->hash[hash] = index;
+	}
+
+	source_lru_unlink(table, index);
+	source_lru_push(table, index);
+
+	return &table->entries[index];
+}
+
+#endif
+
+/* Applies the per-source and per-interface rate limits to a valid solicitation.
+   Solicitations from the unspecified address are only limited per interface,
+   as they can't be told apart. */
+static bool rs_rate_limit(struct iface *iface, const struct in6_addr *addr) {
+#ifndef URADVD_STATIC
+	if (G.rs_limit_source.rate && !IN6_IS_ADDR_UNSPECIFIED(addr)) {
+		struct source_entry *source = get_source(addr, iface);
+
+		if (!rate_limit_take(&G.rs_limit_source, &source->tat)) {
+			iface->stats.rs_ratelimited_source++;
+			return false;
+		}
+	}
+#endif
+
+	if (!rate_limit_take(&G.rs_limit_iface, &iface->rs_tat)) {
+		iface->stats.rs_ratelimited_iface++;
+		return false;
+	}
+
+	return true;
+}
+
+#ifdef URADVD_STATIC
+
+/* The static build keeps no statistics, and only counts the solicitations
+   waiting for the next multicast RA */
+static inline void stats_rs_pending(struct iface *iface, uint64_t time __attribute__((unused)), uint32_t count) {
+	iface->rs_aggregate.count += count;
+}
+
+static inline void stats_rs_answered(struct iface *iface, bool peer __attribute__((unused))) {
+	iface->rs_aggregate = (struct rs_aggregate){};
+}
+
+#else
+
+static void stats_rs_pending(struct iface *iface, uint64_t time, uint32_t count) {
+	struct iface_stats *stats = &iface->stats;
+	struct rs_aggregate *aggregate = &iface->rs_aggregate;
+
+	if (!aggregate->count || time < aggregate->first)
+		aggregate->first = time;
+	if (!aggregate->count || time > aggregate->last)
+		aggregate->last = time;
+	aggregate->count += count;
+
+	if (stats->n_rs_pending == RS_PENDING_MAX) {
+		stats->rs_pending[RS_PENDING_MAX-1].count += count;
+		return;
+	}
+
+	stats->rs_pending[stats->n_rs_pending++] = (struct rs_pending){ .time = time, .count = count };
+}
+
+static void stats_rs_latency(struct iface *iface, uint64_t time, uint32_t count) {
+	uint64_t latency = (G.now - time) / NSEC_PER_MSEC;
+	size_t bucket = 0;
+
+	while (bucket < LATENCY_BUCKETS-1 && latency >= (1ull << bucket))
+		bucket++;
+
+	iface->stats.rs_latency[bucket] += count;
+}
+
+/* Accounts the latency of all pending solicitations, which have been answered
+   by a multicast RA. peer is set when it has been sent by another router. */
+static void stats_rs_answered(struct iface *iface, bool peer) {
+	struct iface_stats *stats = &iface->stats;
+	struct rs_aggregate *aggregate = &iface->rs_aggregate;
+	size_t i;
+
+	for (i = 0; i < stats->n_rs_pending; i++)
+		stats_rs_latency(iface, stats->rs_pending[i].time, stats->rs_pending[i].count);
+
+	stats->n_rs_pending = 0;
+
+	if (!aggregate->count)
+		return;
+
+	if (peer) {
+		stats->rs_peer_answered += aggregate->count;
+		*aggregate = (struct rs_aggregate){};
+		return;
+	}
+
+	aggregate->sent = G.now;
+
+	stats->ra_aggregated++;
+	stats->rs_aggregated += aggregate->count;
+	if (aggregate->count > stats->rs_aggregated_max)
+		stats->rs_aggregated_max = aggregate->count;
+	if (aggregate->clamped) {
+		stats->ra_clamped++;
+		stats->clamp_delay += aggregate->clamp_delay;
+	}
+	if (aggregate->storm)
+		stats->ra_storm_delayed++;
+
+	stats->last_aggregate = *aggregate;
+	*aggregate = (struct rs_aggregate){};
+}
+
+#endif
+
+#ifndef URADVD_STATIC
+
+/* Answers all solicitors waiting for a unicast RA with a single multicast RA instead */
+static void unicast_fallback(struct iface *iface) {
+	size_t i;
+
+	for (i = 0; i < iface->n_unicast; i++)
+		stats_rs_pending(iface, iface->unicast[i].time, iface->unicast[i].count);
+
+	iface->n_unicast = 0;
+	timer_cancel(&iface->unicast_timer);
+
+	iface->stats.unicast_fallbacks++;
+	iface->advert_solicited = true;
+	schedule_advert(iface, true);
+}
+
+/* Queues a unicast reply to a valid solicitation. Returns false when the
+   solicitation must be answered by a multicast RA instead. */
+static bool queue_unicast(struct iface *iface, const struct in6_addr *addr, const uint8_t *buffer, size_t len) {
+	size_t i;
+
+	/* A multicast RA is on its way anyway */
+	if (!G.unicast_max || iface->advert_solicited)
+		return false;
+
+	if (IN6_IS_ADDR_UNSPECIFIED(addr))
+		return false;
+
+	for (i = 0; i < iface->n_unicast; i++) {
+		if (IN6_ARE_ADDR_EQUAL(&iface->unicast[i].addr, addr)) {
+			iface->unicast[i].count++;
+			return true;
+		}
+	}
+
+	if (iface->n_unicast == G.unicast_max) {
+		unicast_fallback(iface);
+		return false;
+	}
+
+	struct unicast_pending *entry = &iface->unicast[iface->n_unicast++];
+	*entry = (struct unicast_pending){ .addr = *addr, .time = G.now, .count = 1 };
+
+	const uint8_t *mac = rs_get_slla(buffer, len);
+	if (mac) {
+		memcpy(entry->mac, mac, sizeof(entry->mac));
+		entry->has_mac = true;
+	}
+
+	/* Solicited RAs must be delayed, unicast ones as well (RFC 4861, section 6.2.6);
+	   each of them answers a single solicitor */
+	if (!timer_pending(&iface->unicast_timer))
+		timer_set_in(&iface->unicast_timer, random_delay(0, G.ra_delay_single));
+
+	return true;
+}
+
+#endif
+
+#ifndef URADVD_STATIC
+
+/* Returns a mask of the n lowest bits, n <= 64 */
+static inline uint64_t low_bits(size_t n) {
+	return n < 64 ? (1ull << n) - 1 : UINT64_MAX;
+}
+
+/* Checks if a router advertisement (RFC 4861, section 6.1.2) announces the
+   same prefixes, RDNSS servers and default router lifetime as our own.
+   Lifetimes of options are not compared, but options with a lifetime of 0
+   never match. When our content is split into several RAs, or hasn't been
+   serialized since it last changed, no RA matches: a peer advertising it
+   would have to split it as well, and a single RA of its set doesn't show
+   that the others are sent. */
+static bool peer_advert_matches(const struct iface *iface, const uint8_t *buffer, size_t len) {
+	const struct config *conf = &iface->conf;
+	uint64_t prefixes = 0, rdnss = 0;
+	size_t i;
+
+	if (len < sizeof(struct nd_router_advert) || buffer[1] != 0)
+		return false;
+
+	if (iface->n_ra != 1)
+		return false;
+
+	/* Matching options are tracked in bitmasks, which larger configurations don't fit */
+	if (conf->n_prefixes > 64 || conf->n_rdnss > 64)
+		return false;
+
+	const struct nd_router_advert *advert = (const struct nd_router_advert *)buffer;
+	if (advert->nd_ra_flags_reserved != 0 || !advert->nd_ra_router_lifetime != !conf->adv_default_lifetime)
+		return false;
+
+	const uint8_t *opt = buffer + sizeof(struct nd_router_advert), *end = buffer + len;
+
+	while (opt < end) {
+		if (end - opt < 2)
+			return false;
+
+		size_t opt_len = 8 * (size_t)opt[1];
+		if (!opt_len || opt_len > (size_t)(end - opt))
+			return false;
+
+		if (opt[0] == ND_OPT_PREFIX_INFORMATION) {
+			struct nd_opt_prefix_info pi;
+			if (opt_len != sizeof(pi))
+				return false;
+
+			memcpy(&pi, opt, sizeof(pi));
+			if (pi.nd_opt_pi_prefix_len != 64 || !pi.nd_opt_pi_valid_time || !pi.nd_opt_pi_preferred_time)
+				return false;
+
+			for (i = 0; i < conf->n_prefixes; i++) {
+				uint8_t flags = ND_OPT_PI_FLAG_AUTO | (conf->prefixes[i].onlink ? ND_OPT_PI_FLAG_ONLINK : 0);
+
+				if (pi.nd_opt_pi_flags_reserved == flags && IN6_ARE_ADDR_EQUAL(&pi.nd_opt_pi_prefix, &conf->prefixes[i].addr))
+					break;
+			}
+
+			if (i == conf->n_prefixes)
+				return false;
+
+			prefixes |= 1ull << i;
+		}
+		else if (opt[0] == 25 /* RDNSS */) {
+			struct nd_opt_rdnss hdr;
+			if (opt_len < sizeof(hdr) + sizeof(struct in6_addr))
+				return false;
+
+			memcpy(&hdr, opt, sizeof(hdr));
+			if (!hdr.nd_opt_rdnss_lifetime)
+				return false;
+
+			const uint8_t *addr;
+			for (addr = opt + sizeof(hdr); addr + sizeof(struct in6_addr) <= opt + opt_len; addr += sizeof(struct in6_addr)) {
+				for (i = 0; i < conf->n_rdnss; i++) {
+					if (memcmp(addr, conf->rdnss[i].s6_addr, sizeof(struct in6_addr)) == 0)
+						break;
+				}
+
+				if (i == conf->n_rdnss)
+					return false;
+
+				rdnss |= 1ull << i;
+			}
+		}
+
+		opt += opt_len;
+	}
+
+	return prefixes == low_bits(conf->n_prefixes) && rdnss == low_bits(conf->n_rdnss);
+}
+
+/* A multicast RA of another router with our content answers pending solicitations
+   just like ours would, and makes our next unsolicited RA unnecessary. Returns
+   true for such RAs. */
+static bool handle_peer_advert(struct iface *iface, const struct msghdr *msg, const uint8_t *buffer, size_t len) {
+	const struct sockaddr_in6 *addr = msg->msg_name;
+	const struct in6_pktinfo *pktinfo = get_cmsg(msg, IPV6_PKTINFO);
+
+	if (get_hoplimit(msg) != 255 || !IN6_IS_ADDR_LINKLOCAL(&addr->sin6_addr))
+		return false;
+
+	/* Our own RAs are looped back */
+	if (IN6_ARE_ADDR_EQUAL(&addr->sin6_addr, &iface->ifaddr))
+		return false;
+
+	if (!pktinfo || !IN6_IS_ADDR_MULTICAST(&pktinfo->ipi6_addr))
+		return false;
+
+	if (!peer_advert_matches(iface, buffer, len))
+		return false;
+
+	iface->stats.ra_peer_matching++;
+	iface->last_peer_advert = G.now;
+
+	/* Withdrawals are only ever announced by our own RAs */
+	if (iface->advert_solicited && !iface->n_withdrawn) {
+		stats_rs_answered(iface, true);
+		iface->stats.ra_suppressed++;
+		iface->advert_solicited = false;
+		schedule_advert(iface, false);
+	}
+
+	return true;
+}
+
+#endif
+
+/* Returns the served interface a packet has been received on, or NULL */
+static struct iface * get_recv_iface(const struct netns *ns, const struct msghdr *msg) {
+	const struct in6_pktinfo *pktinfo = get_cmsg(msg, IPV6_PKTINFO);
+	if (!pktinfo)
+		return NULL;
+
+	return get_iface(ns, pktinfo->ipi6_ifindex);
+}
+
+/* Drains the ICMP socket of a namespace in batches and dispatches the packets
+   to the interfaces they have been received on; any number of valid
+   solicitations results in a single scheduled RA per interface */
+static void handle_icmp(struct watch *watch) {
+	struct netns *ns = container_of(watch, struct netns, icmp_watch);
+	static struct sockaddr_in6 addrs[RS_BATCH_SIZE];
+	static uint8_t buffers[RS_BATCH_SIZE][1500] __attribute__((aligned(8)));
+	static uint8_t cbufs[RS_BATCH_SIZE][RS_CBUF_SIZE] __attribute__((aligned(8)));
+	static struct iovec vecs[RS_BATCH_SIZE];
+	static struct mmsghdr msgs[RS_BATCH_SIZE];
+
+	struct iface *iface, *solicited = NULL;
+	size_t i, batch;
+
+	for (batch = 0; batch < RS_MAX_BATCHES; batch++) {
+		for (i = 0; i < RS_BATCH_SIZE; i++) {
+			vecs[i] = (struct iovec){ .iov_base = buffers[i], .iov_len = sizeof(buffers[i]) };
+
+			msgs[i].msg_hdr = (struct msghdr){
+				.msg_name = &addrs[i],
+				.msg_namelen = sizeof(addrs[i]),
+				.msg_iov = &vecs[i],
+				.msg_iovlen = 1,
+				.msg_control = cbufs[i],
+				.msg_controllen = sizeof(cbufs[i]),
+			};
+		}
+
+		int n = recvmmsg(ns->icmp_sock, msgs, RS_BATCH_SIZE, 0, NULL);
+		if (n < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				warn_errno("recvmmsg");
+
+			break;
+		}
+
+		for (i = 0; i < (size_t)n; i++) {
+			iface = get_recv_iface(ns, &msgs[i].msg_hdr);
+			if (!iface)
+				continue;
+
+#ifndef URADVD_STATIC
+			if (msgs[i].msg_len && buffers[i][0] == ND_ROUTER_ADVERT) {
+				/* Also answers the solicitations received before it in this batch */
+				if (handle_peer_advert(iface, &msgs[i].msg_hdr, buffers[i], msgs[i].msg_len))
+					iface->rs_solicited = false;
+
+				continue;
+			}
+#endif
+
+			enum rs_status status = check_solicit(&msgs[i].msg_hdr, buffers[i], msgs[i].msg_len);
+
+			iface->stats.rs_received++;
+			iface->stats.rs_status[status]++;
+
+			/* The final RAs are on their way */
+			if (G.shutdown)
+				continue;
+
+			if (status != RS_VALID || !rs_rate_limit(iface, &addrs[i].sin6_addr))
+				continue;
+
+			iface->rs_since_advert++;
+
+#ifndef URADVD_STATIC
+			if (queue_unicast(iface, &addrs[i].sin6_addr, buffers[i], msgs[i].msg_len))
+				continue;
+#endif
+
+			stats_rs_pending(iface, G.now, 1);
+
+			if (!iface->rs_batch) {
+				iface->rs_batch = true;
+				iface->rs_batch_next = solicited;
+				solicited = iface;
+			}
+
+			iface->rs_solicited = true;
+		}
+
+		if (n < RS_BATCH_SIZE)
+			break;
+	}
+
+	for (iface = solicited; iface; iface = iface->rs_batch_next) {
+		if (iface->rs_solicited) {
+			iface->advert_solicited = true;
+			schedule_advert(iface, true);
+		}
+
+		iface->rs_batch = iface->rs_solicited = false;
+	}
+}
+
+/* Minimum link MTU of IPv6, used when the MTU of an interface is unknown */
+#define IPV6_MIN_MTU 1280u
+
+#ifdef URADVD_STATIC
+
+/* The RAs are copied from the templates generated at build time, and only
+   the interface's link-layer address is filled in. As there is a single
+   interface, its RA buffer doesn't need to be allocated. */
+static void build_advert(struct iface *iface) {
+	static uint8_t buf[sizeof(static_ra)];
+	static struct iovec ra = { .iov_base = buf, .iov_len = sizeof(buf) };
+
+	memcpy(buf, G.shutdown ? static_final_ra : static_ra, sizeof(buf));
+	memcpy(buf + STATIC_RA_MAC_OFFSET, iface->mac, sizeof(iface->mac));
+
+	iface->ra = &ra;
+	iface->n_ra = 1;
+}
+
+#else
+
+/* State while serializing the RAs of an interface */
+struct advert_builder {
+	struct iface *iface;
+	/* Maximum length of a single RA */
+	size_t max_len;
+	/* Bytes used in ra_buf */
+	size_t len;
+	/* Offset of the RDNSS option that further addresses are appended to, or 0 */
+	size_t rdnss;
+	uint16_t router_lifetime;
+};
+
+static inline struct iovec * advert_current(struct advert_builder *b) {
+	return &b->iface->ra[b->iface->n_ra - 1];
+}
+
+/* Appends raw data to the current RA */
+static void advert_put(struct advert_builder *b, const void *data, size_t len) {
+	struct iface *iface = b->iface;
+
+	if (b->len + len > iface->ra_buf_size) {
+		size_t size = iface->ra_buf_size ? iface->ra_buf_size : IPV6_MIN_MTU;
+		while (size < b->len + len)
+			size *= 2;
+
+		iface->ra_buf = realloc(iface->ra_buf, size);
+		if (!iface->ra_buf)
+			exit_errno("realloc");
+
+		iface->ra_buf_size = size;
+	}
+
+	memcpy(iface->ra_buf + b->len, data, len);
+	b->len += len;
+	advert_current(b)->iov_len += len;
+}
+
+/* Starts a new RA; the header and the interface's link-layer address and MTU
+   are repeated in every RA */
+static void advert_start(struct advert_builder *b) {
+	struct iface *iface = b->iface;
+
+	iface->ra = array_grow(iface->ra, iface->n_ra, &iface->ra_size, sizeof(*iface->ra));
+	iface->ra[iface->n_ra++] = (struct iovec){};
+	b->rdnss = 0;
+
+	struct nd_router_advert advert = {
+		.nd_ra_hdr = {
+			.icmp6_type = ND_ROUTER_ADVERT,
+			.icmp6_dataun.icmp6_un_data8 = {AdvCurHopLimit, 0 /* Flags */, (b->router_lifetime>>8) & 0xff, b->router_lifetime & 0xff },
+		},
+	};
+	advert_put(b, &advert, sizeof(advert));
+
+	struct icmpv6_opt lladdr = {ND_OPT_SOURCE_LINKADDR, 1, {}};
+	memcpy(lladdr.data, iface->mac, sizeof(iface->mac));
+	advert_put(b, &lladdr, sizeof(lladdr));
+
+	if (iface->mtu) {
+		struct nd_opt_mtu mtu = {
+			.nd_opt_mtu_type = ND_OPT_MTU,
+			.nd_opt_mtu_len = 1,
+			.nd_opt_mtu_mtu = htonl(iface->mtu),
+		};
+		advert_put(b, &mtu, sizeof(mtu));
+	}
+}
+
+/* Appends an option, starting a new RA if it doesn't fit into the current one */
+static void advert_put_option(struct advert_builder *b, const void *data, size_t len) {
+	if (advert_current(b)->iov_len + len > b->max_len)
+		advert_start(b);
+
+	advert_put(b, data, len);
+}
+
+/* Appends a prefix information option, returning its offset in the RA buffer */
+static size_t advert_put_prefix(struct advert_builder *b, const struct in6_addr *addr, bool onlink, uint32_t valid, uint32_t preferred) {
+	struct nd_opt_prefix_info prefix = {
+		.nd_opt_pi_type = ND_OPT_PREFIX_INFORMATION,
+		.nd_opt_pi_len = 4,
+		.nd_opt_pi_prefix_len = 64,
+		.nd_opt_pi_flags_reserved = ND_OPT_PI_FLAG_AUTO | (onlink ? ND_OPT_PI_FLAG_ONLINK : 0),
+		.nd_opt_pi_valid_time = htonl(valid),
+		.nd_opt_pi_preferred_time = htonl(preferred),
+		.nd_opt_pi_prefix = *addr,
+	};
+	advert_put_option(b, &prefix, sizeof(prefix));
+
+	return b->len - sizeof(prefix);
+}
+
+/* Appends RDNSS servers with the same lifetime, which are combined into as few
+   options as possible; when an RA is full, the rest goes into another option
+   in the next one */
+static void advert_put_rdnss(struct advert_builder *b, const struct in6_addr *addrs, size_t n, uint32_t lifetime) {
+	const size_t addr_len = sizeof(struct in6_addr);
+	size_t i;
+
+	b->rdnss = 0;
+
+	for (i = 0; i < n; i++) {
+		uint8_t *opt = b->rdnss ? b->iface->ra_buf + b->rdnss : NULL;
+
+		if (!opt || advert_current(b)->iov_len + addr_len > b->max_len || opt[1] + 2 > UINT8_MAX) {
+			struct nd_opt_rdnss rdnss = {
+				.nd_opt_rdnss_type = 25,
+				.nd_opt_rdnss_len = 1,
+				.nd_opt_rdnss_lifetime = htonl(lifetime),
+			};
+
+			if (advert_current(b)->iov_len + sizeof(rdnss) + addr_len > b->max_len)
+				advert_start(b);
+
+			b->rdnss = b->len;
+			advert_put(b, &rdnss, sizeof(rdnss));
+		}
+
+		advert_put(b, addrs[i].s6_addr, addr_len);
+		b->iface->ra_buf[b->rdnss + 1] += 2;
+	}
+}
+
+/* Serializes the router advertisements for an interface into its RA buffer.
+   All options are packed into as few RAs as the link MTU allows; every RA
+   except the last one is filled up to the MTU. On shutdown, the router
+   lifetime and the preferred lifetimes of all prefixes are 0, so clients
+   move to other routers and prefixes. */
+static void build_advert(struct iface *iface) {
+	struct config *conf = &iface->conf;
+	size_t i;
+
+	uint32_t mtu = iface->mtu >= IPV6_MIN_MTU ? iface->mtu : IPV6_MIN_MTU;
+
+	struct advert_builder b = {
+		.iface = iface,
+		.max_len = mtu - sizeof(struct ip6_hdr),
+		.router_lifetime = G.shutdown ? 0 : conf->adv_default_lifetime,
+	};
+
+	iface->n_ra = 0;
+	advert_start(&b);
+
+	for (i = 0; i < conf->n_prefixes; i++) {
+		struct prefix *prefix = &conf->prefixes[i];
+
+		prefix->ra_offset = advert_put_prefix(&b, &prefix->addr, prefix->onlink,
+						      prefix_valid_lifetime(prefix), prefix_preferred_lifetime(prefix));
+	}
+
+	advert_put_rdnss(&b, conf->rdnss, conf->n_rdnss, AdvRDNSSLifetime);
+
+	/* Removed prefixes are announced with valid lifetime 0 as well. Hosts don't
+	   shorten the valid lifetime below 2 hours this way (RFC 4862, section
+	   5.5.3 e), so this deprecates them right away, while their addresses
+	   remain valid for up to 2 hours; RDNSS servers with lifetime 0 are removed. */
+	struct in6_addr rdnss_withdrawn[iface->n_withdrawn ? iface->n_withdrawn : 1];
+	size_t n_rdnss_withdrawn = 0;
+	for (i = 0; i < iface->n_withdrawn; i++) {
+		const struct withdrawal *w = &iface->withdrawn[i];
+
+		if (w->rdnss)
+			rdnss_withdrawn[n_rdnss_withdrawn++] = w->addr;
+		else
+			advert_put_prefix(&b, &w->addr, w->onlink, 0, 0);
+	}
+
+	advert_put_rdnss(&b, rdnss_withdrawn, n_rdnss_withdrawn, 0);
+
+	/* The RAs are only placed into the buffer now, as it may have been moved while growing */
+	uint8_t *p = iface->ra_buf;
+	for (i = 0; i < iface->n_ra; i++) {
+		iface->ra[i].iov_base = p;
+		p += iface->ra[i].iov_len;
+	}
+}
+
+#endif
+
+#ifdef URADVD_STATIC
+
+/* The lifetimes in the templates never change */
+static inline void update_lifetimes(struct iface *iface) {
+	if (!iface->n_ra)
+		build_advert(iface);
+}
+
+#else
+
+/* Brings the lifetimes of the prefixes in the cached RAs up to date, which
+   just patches the lifetime fields in place. This is done for all prefixes,
+   so an expiry time that was changed or removed is applied as well. Prefixes
+   that have expired are dropped, which requires a rebuild; as they have
+   expired on the clients at the same time, they aren't withdrawn. */
+static void update_lifetimes(struct iface *iface) {
+	struct config *conf = &iface->conf;
+	size_t i;
+
+	for (i = conf->n_prefixes; i-- > 0;) {
+		const struct prefix *prefix = &conf->prefixes[i];
+
+		if (prefix->valid_until && prefix->valid_until <= G.now) {
+			config_del_prefix(conf, i);
+			invalidate_advert(iface);
+		}
+	}
+
+	if (!iface->n_ra) {
+		build_advert(iface);
+		return;
+	}
+
+	for (i = 0; i < conf->n_prefixes; i++) {
+		const struct prefix *prefix = &conf->prefixes[i];
+		uint8_t *opt = iface->ra_buf + prefix->ra_offset;
+		uint32_t valid = htonl(prefix_valid_lifetime(prefix));
+		uint32_t preferred = htonl(prefix_preferred_lifetime(prefix));
+
+		memcpy(opt + offsetof(struct nd_opt_prefix_info, nd_opt_pi_valid_time), &valid, sizeof(valid));
+		memcpy(opt + offsetof(struct nd_opt_prefix_info, nd_opt_pi_preferred_time), &preferred, sizeof(preferred));
+	}
+}
+
+#endif
+
+static const struct in6_addr all_nodes = {
+	.s6_addr = {
+		0xff, 0x02, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x01,
+	}
+};
+
+/* Sends the (cached) router advertisements of an interface to the given
+   destination, starting after the first *sent ones. Returns a negative value
+   when one of them can't be sent; *sent is the number of RAs sent so far then,
+   and 0 after all of them have been sent. */
+static int send_ra(struct iface *iface, const struct in6_addr *dest, size_t *sent) {
+	update_lifetimes(iface);
+
+	/* A rebuild has reset the count in invalidate_advert() */
+	if (*sent >= iface->n_ra)
+		*sent = 0;
+
+	struct sockaddr_in6 addr = {
+		.sin6_family = AF_INET6,
+		.sin6_addr = *dest,
+		.sin6_scope_id = iface->ifindex,
+	};
+
+	uint8_t cbuf[CMSG_SPACE(sizeof(struct in6_pktinfo))] __attribute__((aligned(8))) = {};
+
+	struct msghdr msg = {
+		.msg_name = &addr,
+		.msg_namelen = sizeof(addr),
+		.msg_iovlen = 1,
+		.msg_control = cbuf,
+		.msg_controllen = 0,
+		.msg_flags = 0,
+	};
+
+	add_pktinfo(iface, &msg);
+
+	for (; *sent < iface->n_ra; (*sent)++) {
+		msg.msg_iov = &iface->ra[*sent];
+
+		if (sendmsg(iface->netns->icmp_sock, &msg, 0) < 0)
+			return -1;
+	}
+
+	*sent = 0;
+	return 0;
+}
+
+/*
+  Adapts the unsolicited RA interval to the rate of solicitations since the
+  last multicast RA: under solicitation load, more frequent RAs let new
+  clients configure without a round trip. Without solicitations, the interval
+  grows back, but never beyond MaxRtrAdvInterval, so quiet segments get the
+  regular RFC 4861 schedule.
+*/
+static void adapt_ra_interval(struct iface *iface) {
+	const struct config *conf = &iface->conf;
+	const uint64_t elapsed = (G.now - iface->last_advert) / NSEC_PER_MSEC;
+	uint64_t interval = iface->ra_interval;
+
+	/* rs_since_advert/elapsed * interval >= RS_BUSY_THRESHOLD, without division */
+	if (iface->rs_since_advert && iface->rs_since_advert * interval >= RS_BUSY_THRESHOLD * elapsed)
+		interval /= 2;
+	else if (!iface->rs_since_advert)
+		interval += interval/4;
+
+	if (interval < conf->min_ra_interval * 1000ull)
+		interval = conf->min_ra_interval * 1000ull;
+	if (interval > conf->max_ra_interval * 1000ull)
+		interval = conf->max_ra_interval * 1000ull;
+
+	iface->ra_interval = interval;
+	iface->last_advert = G.now;
+	iface->rs_since_advert = 0;
+}
+
+/* Errors after which the interface is gone or down; advertising resumes
+   when the netlink events announcing its return have been handled */
+static inline bool send_error_fatal(int err) {
+	switch (err) {
+	case ENXIO:
+	case ENODEV:
+	case ENETDOWN:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/* Errors caused by congestion or memory pressure. A missing route or source
+   address (for example while the link-local address is still tentative) is
+   retried as well, as no netlink event has to follow it. */
+static inline bool send_error_transient(int err) {
+	switch (err) {
+	case ENOBUFS:
+	case ENOMEM:
+	case EAGAIN:
+	case EINTR:
+	case ENETUNREACH:
+	case EADDRNOTAVAIL:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/* Accounts a send error, returning true if the interface must be considered down */
+static bool send_failed(struct iface *iface, int err) {
+	if (send_error_fatal(err)) {
+		iface->stats.ra_failed_fatal++;
+		iface->ok = false;
+		return true;
+	}
+
+	if (send_error_transient(err))
+		iface->stats.ra_failed_transient++;
+	else
+		warn_error("can't send RA", err);
+
+	return false;
+}
+
+#ifndef URADVD_STATIC
+
+/* Drops withdrawals that have been announced often enough after a multicast RA */
+static void age_withdrawals(struct iface *iface) {
+	size_t i, j = 0;
+
+	for (i = 0; i < iface->n_withdrawn; i++) {
+		if (--iface->withdrawn[i].adverts)
+			iface->withdrawn[j++] = iface->withdrawn[i];
+	}
+
+	if (j != iface->n_withdrawn) {
+		iface->n_withdrawn = j;
+		invalidate_advert(iface);
+	}
+}
+
+#endif
+
+/* Exits when all final RAs have been sent */
+static void check_shutdown(void) {
+	const struct iface *iface;
+
+	for_each_iface(iface) {
+		if (timer_pending(&iface->advert_timer))
+			return;
+	}
+
+	log_flush_exit();
+	exit(0);
+}
+
+/* Starts sending the final RAs of RFC 4861, section 6.2.5 on all interfaces.
+   Exits immediately when it is called a second time. */
+static void start_shutdown(void) {
+	struct iface *iface;
+
+	if (G.shutdown) {
+		log_flush_exit();
+		exit(0);
+	}
+
+	G.shutdown = true;
+
+	for_each_iface(iface) {
+#ifndef URADVD_STATIC
+		/* Solicitors waiting for a unicast reply get the final multicast RA */
+		timer_cancel(&iface->unicast_timer);
+		iface->n_unicast = 0;
+#endif
+
+		invalidate_advert(iface);
+
+		iface->final_adverts = iface->ok ? G.final_adverts : 0;
+		if (!iface->final_adverts) {
+			timer_cancel(&iface->advert_timer);
+			continue;
+		}
+
+		timer_set(&iface->advert_timer, iface->next_advert_earliest > G.now ? iface->next_advert_earliest : G.now);
+	}
+
+	check_shutdown();
+}
+
+static void send_final_advert(struct iface *iface) {
+	if (!iface->ok) {
+		check_shutdown();
+		return;
+	}
+
+	if (send_ra(iface, &all_nodes, &iface->n_ra_sent) < 0) {
+		int err = errno;
+		iface->stats.ra_failed++;
+
+		if (!send_failed(iface, err) && send_error_transient(err) && iface->send_retries < SEND_MAX_RETRIES)
+			timer_set_in(&iface->advert_timer, SEND_RETRY_DELAY << iface->send_retries++);
+
+		check_shutdown();
+		return;
+	}
+
+	iface->send_retries = 0;
+	iface->stats.ra_sent++;
+
+	if (iface->final_adverts && --iface->final_adverts)
+		timer_set_in(&iface->advert_timer, MIN_DELAY_BETWEEN_RAS);
+
+	check_shutdown();
+}
+
+/* Retries a multicast RA after a transient error with exponential backoff.
+   Other errors, or too many retries, drop it and leave the regular schedule
+   in place. */
+static void advert_failed(struct iface *iface, int err, bool solicited) {
+	iface->stats.ra_failed++;
+
+	if (send_failed(iface, err))
+		return;
+
+	if (send_error_transient(err) && iface->send_retries < SEND_MAX_RETRIES) {
+		timer_set_in(&iface->advert_timer, SEND_RETRY_DELAY << iface->send_retries++);
+		iface->advert_solicited = solicited;
+		return;
+	}
+
+	if (send_error_transient(err))
+		iface->stats.ra_dropped++;
+
+	/* The RAs sent before the error count like a complete RA */
+	if (iface->n_ra_sent)
+		iface->next_advert_earliest = G.now + MIN_DELAY_BETWEEN_RAS * NSEC_PER_MSEC;
+
+	iface->n_ra_sent = 0;
+	iface->send_retries = 0;
+	schedule_advert(iface, false);
+}
+
+static void send_advert(struct timer *timer) {
+	struct iface *iface = container_of(timer, struct iface, advert_timer);
+
+	if (G.shutdown) {
+		send_final_advert(iface);
+		return;
+	}
+
+	bool solicited = iface->advert_solicited;
+	iface->advert_solicited = false;
+
+	if (!iface->ok)
+		return;
+
+#ifndef URADVD_STATIC
+	if (G.suppress && !solicited && !iface->initial_adverts && !iface->n_withdrawn && iface->last_peer_advert && G.now - iface->last_peer_advert < iface->ra_interval * NSEC_PER_MSEC) {
+		iface->stats.ra_suppressed++;
+		schedule_advert(iface, false);
+		return;
+	}
+#endif
+
+	if (send_ra(iface, &all_nodes, &iface->n_ra_sent) < 0) {
+		advert_failed(iface, errno, solicited);
+		return;
+	}
+
+	iface->send_retries = 0;
+	iface->stats.ra_sent++;
+	stats_rs_answered(iface, false);
+
+	if (!iface->stats.first_ra)
+		iface->stats.first_ra = G.now - G.start_time;
+
+	if (iface->initial_adverts)
+		iface->initial_adverts--;
+
+#ifndef URADVD_STATIC
+	age_withdrawals(iface);
+#endif
+
+	iface->next_advert_earliest = G.now + MIN_DELAY_BETWEEN_RAS * NSEC_PER_MSEC;
+
+	adapt_ra_interval(iface);
+	schedule_advert(iface, false);
+}
+
+#ifndef URADVD_STATIC
+
+/* Creates a STALE neighbour entry from the link-layer address given in a
+   solicitation, so the unicast RA doesn't wait for address resolution. An
+   existing entry is left alone. The request is sent on the non-blocking event
+   socket without waiting for an acknowledgement; the kernel only replies on
+   failure, which is handled by handle_rtnl(). */
+static void add_neighbour(const struct iface *iface, const struct in6_addr *addr, const uint8_t *mac) {
+	struct {
+		struct nlmsghdr nh;
+		struct ndmsg msg;
+		uint8_t attrs[RTA_SPACE(sizeof(struct in6_addr)) + RTA_SPACE(6)];
+	} req = {
+		.nh = {
+			.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg)),
+			.nlmsg_type = RTM_NEWNEIGH,
+			.nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL,
+		},
+		.msg = {
+			.ndm_family = AF_INET6,
+			.ndm_ifindex = iface->ifindex,
+			.ndm_state = NUD_STALE,
+		},
+	};
+
+	rtnl_add_attr(&req.nh, NDA_DST, addr, sizeof(*addr));
+	rtnl_add_attr(&req.nh, NDA_LLADDR, mac, 6);
+
+	if (send(iface->netns->rtnl_sock, &req, req.nh.nlmsg_len, 0) < 0)
+		warn_errno("can't add neighbour entry");
+}
+
+static void send_unicast_adverts(struct timer *timer) {
+	struct iface *iface = container_of(timer, struct iface, unicast_timer);
+	size_t i;
+
+	for (i = 0; i < iface->n_unicast && iface->ok; i++) {
+		const struct unicast_pending *entry = &iface->unicast[i];
+
+		if (entry->has_mac)
+			add_neighbour(iface, &entry->addr, entry->mac);
+
+		size_t sent = 0;
+		if (send_ra(iface, &entry->addr, &sent) < 0) {
+			iface->stats.ra_unicast_failed++;
+			send_failed(iface, errno);
+			continue;
+		}
+
+		iface->stats.ra_unicast_sent++;
+		stats_rs_latency(iface, entry->time, entry->count);
+	}
+
+	iface->n_unicast = 0;
+}
+
+#endif
+
+
+#ifndef URADVD_STATIC
+
+static void print_stats(FILE *f) {
+	const struct iface *iface;
+	size_t i;
+
+	for_each_iface(iface) {
+		const struct iface_stats *stats = &iface->stats;
+
+		fprintf(f, "%s: ifindex %u, %s\n", iface->name, iface->ifindex, iface->ok ? "ok" : "down");
+		fprintf(f, "  rs_received %" PRIu64 "\n", stats->rs_received);
+
+		for (i = 0; i < RS_STATUS_MAX; i++)
+			fprintf(f, "  rs_%s %" PRIu64 "\n", rs_status_names[i], stats->rs_status[i]);
+
+		fprintf(f, "  rs_ratelimited_source %" PRIu64 "\n", stats->rs_ratelimited_source);
+		fprintf(f, "  rs_ratelimited_iface %" PRIu64 "\n", stats->rs_ratelimited_iface);
+
+		fprintf(f, "  ra_sent %" PRIu64 "\n", stats->ra_sent);
+		fprintf(f, "  ra_failed %" PRIu64 "\n", stats->ra_failed);
+		fprintf(f, "  ra_failed_transient %" PRIu64 "\n", stats->ra_failed_transient);
+		fprintf(f, "  ra_failed_fatal %" PRIu64 "\n", stats->ra_failed_fatal);
+		fprintf(f, "  ra_dropped %" PRIu64 "\n", stats->ra_dropped);
+		fprintf(f, "  ra_unicast_sent %" PRIu64 "\n", stats->ra_unicast_sent);
+		fprintf(f, "  ra_unicast_failed %" PRIu64 "\n", stats->ra_unicast_failed);
+		fprintf(f, "  unicast_fallbacks %" PRIu64 "\n", stats->unicast_fallbacks);
+		fprintf(f, "  ra_peer_matching %" PRIu64 "\n", stats->ra_peer_matching);
+		fprintf(f, "  ra_suppressed %" PRIu64 "\n", stats->ra_suppressed);
+		fprintf(f, "  ra_interval_ms %" PRIu64 "\n", iface->ra_interval);
+
+		if (stats->first_ra)
+			fprintf(f, "  first_ra_us %" PRIu64 "\n", stats->first_ra / 1000);
+		else
+			fprintf(f, "  first_ra_us -\n");
+
+		fprintf(f, "  ra_aggregated %" PRIu64 "\n", stats->ra_aggregated);
+		fprintf(f, "  rs_aggregated %" PRIu64 "\n", stats->rs_aggregated);
+		fprintf(f, "  rs_aggregated_max %" PRIu32 "\n", stats->rs_aggregated_max);
+		fprintf(f, "  ra_clamped %" PRIu64 "\n", stats->ra_clamped);
+		fprintf(f, "  ra_clamp_delay_ms %" PRIu64 "\n", (uint64_t)(stats->clamp_delay / NSEC_PER_MSEC));
+		fprintf(f, "  ra_storm_delayed %" PRIu64 "\n", stats->ra_storm_delayed);
+		fprintf(f, "  rs_peer_answered %" PRIu64 "\n", stats->rs_peer_answered);
+
+		const struct rs_aggregate *last = &stats->last_aggregate;
+		if (last->count)
+			fprintf(f, "  last_aggregate rs %" PRIu32 ", span_ms %" PRIu64 ", delay_ms %" PRIu64 ", clamped %s, storm %s, age_ms %" PRIu64 "\n",
+				last->count, (uint64_t)((last->last - last->first) / NSEC_PER_MSEC), (uint64_t)((last->sent - last->first) / NSEC_PER_MSEC),
+				last->clamped ? "yes" : "no", last->storm ? "yes" : "no", (uint64_t)((G.now - last->sent) / NSEC_PER_MSEC));
+
+		fprintf(f, "  rs_latency_ms");
+		for (i = 0; i < LATENCY_BUCKETS-1; i++)
+			fprintf(f, " <%llu:%" PRIu64, 1ull << i, stats->rs_latency[i]);
+		fprintf(f, " >=%llu:%" PRIu64 "\n", 1ull << (LATENCY_BUCKETS-2), stats->rs_latency[LATENCY_BUCKETS-1]);
+	}
+
+	fprintf(f, "log: suppressed %" PRIu64 ", dropped %" PRIu64 "\n", G.log_suppressed, G.log_dropped);
+
+	fflush(f);
+}
+
+/* Writes the statistics to stderr without blocking; they are formatted right
+   away and written out along with the log records. A request while the
+   previous statistics are still being written is ignored. */
+static void write_stats(void) {
+	if (G.stats_out.len)
+		return;
+
+	FILE *f = open_memstream(&G.stats_out.buf, &G.stats_out.len);
+	if (!f) {
+		warn_errno("open_memstream");
+		return;
+	}
+
+	print_stats(f);
+	fclose(f);
+
+	log_flush();
+}
+
+#endif
+
+
+static void handle_signal(struct watch *watch) {
+	struct signalfd_siginfo si;
+
+	while (read(watch->fd, &si, sizeof(si)) == sizeof(si)) {
+		switch (si.ssi_signo) {
+#ifndef URADVD_STATIC
+		case SIGUSR1:
+			write_stats();
+			break;
+#endif
+
+		case SIGINT:
+		case SIGTERM:
+			start_shutdown();
+		}
+	}
+}
+
+static void init_signals(void) {
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+		exit_errno("sigprocmask");
+
+	int fd = signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC);
+	if (fd < 0)
+		exit_errno("signalfd");
+
+	static struct watch signal_watch;
+	watch_add(&signal_watch, fd, handle_signal);
+}
+
+
+#ifdef URADVD_STATIC
+
+/* The static build has no command line options and no control socket; its
+   configuration is generated into ra-template.h at build time */
+static void parse_cmdline(int argc __attribute__((unused)), char *argv[] __attribute__((unused))) {
+	struct iface *iface = add_iface(STATIC_IFNAME);
+
+	iface->conf.adv_default_lifetime = STATIC_DEFAULT_LIFETIME;
+	iface->conf.min_ra_interval = STATIC_MIN_RA_INTERVAL;
+	iface->conf.max_ra_interval = STATIC_MAX_RA_INTERVAL;
+}
+
+#else
+
+static void usage(void) {
+	fprintf(stderr, "Usage: uradvd [-h] [ <options> ] -i <interface> [ <options> ] [ -i <interface> [ <options> ] ... ]\n"
+			"Options: -a/-p <prefix> [ -a/-p <prefix> ... ] [ --default-lifetime <seconds> ] [ --rdnss <ip> ... ]\n"
+			"         [ --ra-interval <min seconds>,<max seconds> ] [ --learn-prefixes[=onlink] ]\n"
+			"Options given before the first -i apply to all interfaces.\n"
+			"An interface may be given as <netns>/<interface> to serve it in the network namespace\n"
+			"/run/netns/<netns> (as created by ip netns add).\n"
+			"With --learn-prefixes, the /64 prefixes of the global addresses and directly connected\n"
+			"routes of an interface are advertised in addition to the given ones, like -a (or -p\n"
+			"with =onlink).\n"
+			"Unsolicited RAs are sent at random intervals within --ra-interval (200,600 by default);\n"
+			"under solicitation load, the upper bound is lowered towards the minimum. It never\n"
+			"exceeds the configured maximum.\n"
+			"Statistics are written to stderr on SIGUSR1. On SIGTERM or SIGINT, final RAs withdrawing\n"
+			"the default route and deprecating all prefixes are sent before exiting; a second signal\n"
+			"exits immediately.\n"
+			"Global options: [ --kernel-filter ] [ --refresh-delay <milliseconds> ] [ --netlink-rcvbuf <bytes> ]\n"
+			"                [ --unicast-ra <max solicitors> ] [ --suppress ]\n"
+			"                [ --initial-ras <count>[,<max interval milliseconds>] ] [ --final-ras <count> ]\n"
+			"                [ --control <socket path> ] [ --log stderr|json|syslog ]\n"
+			"                [ --rs-limit <rate>[,<burst>] ] [ --source-rs-limit <rate>[,<burst>] ]\n"
+			"                [ --ra-delay <single milliseconds>[,<milliseconds>] ]\n"
+			"                [ --rs-storm <solicitations>,<milliseconds> ]\n"
+			"Rate limits are given in solicitations per second, 0 disables them.\n"
+			"Solicited RAs are delayed randomly by up to --ra-delay (500 ms by default; the first\n"
+			"value applies when a single solicitation is waiting, and to unicast RAs). When at least --rs-storm\n"
+			"solicitations are waiting, the RA is delayed by up to the given time from the first\n"
+			"one instead, so more of them are answered together.\n"
+			"With --suppress, unsolicited RAs are skipped while another router sends multicast RAs\n"
+			"with the same content, which answer solicitations as well. This doesn't apply to\n"
+			"interfaces whose content doesn't fit into a single RA.\n"
+			"Repeated log messages are rate limited; --log json writes one JSON object per message\n"
+			"to stderr, --log syslog sends them to /dev/log.\n");
+}
+
+static void add_rdnss(struct config *conf, const char *ip) {
+	struct in6_addr addr;
+
+	if (inet_pton(AF_INET6, ip, &addr) != 1) {
+		fprintf(stderr, "uradvd: error: invalid RDNSS IP address %s.\n", ip);
+		exit(1);
+	}
+
+	config_add_rdnss(conf, &addr);
+}
+
+static void add_prefix(struct config *conf, const char *prefix, bool adv_onlink) {
+	struct in6_addr addr;
+
+	if (!ra_parse_prefix(&addr, prefix)) {
+		fprintf(stderr, "uradvd: error: invalid prefix %s (only prefixes of length 64 are supported).\n", prefix);
+		exit(1);
+	}
+
+	config_add_prefix(conf, &addr, adv_onlink, PREFIX_STATIC);
+}
+
+static void parse_ra_interval(struct config *conf, const char *arg) {
+	unsigned long min, max;
+
+	if (!ra_parse_interval(arg, &min, &max)) {
+		fprintf(stderr, "uradvd: error: invalid RA interval %s (must be within %u..%u seconds).\n", arg, MIN_RA_INTERVAL, MAX_RA_INTERVAL);
+		exit(1);
+	}
+
+	conf->min_ra_interval = min;
+	conf->max_ra_interval = max;
+	conf->ra_interval_set = true;
+}
+
+static void parse_rate_limit(struct rate_limit *limit, const char *arg) {
+	char *endptr;
+	unsigned long rate, burst;
+
+	rate = strtoul(arg, &endptr, 0);
+	if (endptr == arg)
+		goto error;
+
+	burst = limit->burst;
+	if (*endptr == ',') {
+		const char *burst_arg = endptr+1;
+
+		burst = strtoul(burst_arg, &endptr, 0);
+		if (endptr == burst_arg)
+			goto error;
+	}
+
+	if (*endptr || rate > NSEC_PER_SEC || !burst || burst > UINT16_MAX)
+		goto error;
+
+	limit->rate = rate;
+	limit->burst = burst;
+	return;
+
+error:
+	fprintf(stderr, "uradvd: error: invalid rate limit %s.\n", arg);
+	exit(1);
+}
+
+/* Merges the settings given before the first -i into an interface's configuration */
+static void merge_defaults(struct iface *iface) {
+	const struct config *defaults = &G.defaults;
+	struct config *conf = &iface->conf;
+	size_t i;
+
+	if (!conf->adv_default_lifetime_set)
+		conf->adv_default_lifetime = defaults->adv_default_lifetime;
+
+	if (!conf->ra_interval_set) {
+		conf->min_ra_interval = defaults->min_ra_interval;
+		conf->max_ra_interval = defaults->max_ra_interval;
 	}
 
-	memset(&G.iface.ifaddr, 0, sizeof(G.iface.ifaddr));
+	if (!conf->learn_prefixes)
+		conf->learn_prefixes = defaults->learn_prefixes;
 
-	for (addr = addrs; addr; addr = addr->ifa_next) {
-		if (!addr->ifa_addr || addr->ifa_addr->sa_family != AF_INET6)
-			continue;
+	for (i = 0; i < defaults->n_prefixes; i++)
+		config_add_prefix(conf, &defaults->prefixes[i].addr, defaults->prefixes[i].onlink, PREFIX_STATIC);
 
-		const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr->ifa_addr;
-		if (!IN6_IS_ADDR_LINKLOCAL(&in6->sin6_addr))
-			continue;
+	for (i = 0; i < defaults->n_rdnss; i++)
+		config_add_rdnss(conf, &defaults->rdnss[i]);
+}
 
-		if (strncmp(addr->ifa_name, G.ifname, IFNAMSIZ-1) != 0)
-			continue;
 
-		G.iface.ifaddr = in6->sin6_addr;
-	}
+/* Parses prefix lifetimes given as <valid seconds>[,<preferred seconds>];
+   the preferred lifetime defaults to the valid lifetime */
+static bool parse_lifetimes(const char *arg, uint32_t *valid, uint32_t *preferred) {
+	char *endptr;
+	unsigned long val;
 
-	freeifaddrs(addrs);
+	val = strtoul(arg, &endptr, 10);
+	if (endptr == arg || !val || val >= UINT32_MAX)
+		return false;
 
-	if (IN6_IS_ADDR_UNSPECIFIED(&G.iface.ifaddr))
-		return;
+	*valid = *preferred = val;
 
-	int joined = join_multicast();
-	if (!joined)
-		return;
+	if (*endptr == ',') {
+		const char *preferred_arg = endptr+1;
 
-	setsockopt(G.icmp_sock, SOL_SOCKET, SO_BINDTODEVICE, G.ifname, strnlen(G.ifname, IFNAMSIZ-1));
+		val = strtoul(preferred_arg, &endptr, 10);
+		if (endptr == preferred_arg || val > *valid)
+			return false;
 
-	G.iface.ok = true;
+		*preferred = val;
+	}
 
-	if (memcmp(&old, &G.iface, sizeof(struct iface)) != 0 || joined == 2)
-		schedule_advert(true);
+	return !*endptr;
 }
 
+static const char * control_prefix(struct iface *iface, const char *cmd, const char *arg, const char *flag, const char *lifetimes) {
+	struct config *conf = &iface->conf;
+	struct in6_addr prefix;
 
-static bool handle_rtnl_link(uint16_t type, const struct ifinfomsg *msg) {
-	switch (type) {
-	case RTM_NEWLINK:
-		if (!G.iface.ok)
-			return true;
+	if (!arg || !ra_parse_prefix(&prefix, arg))
+		return "error: invalid prefix";
 
-		break;
+	ssize_t i = find_prefix(conf, &prefix);
 
-	case RTM_SETLINK:
-		if ((unsigned)msg->ifi_index == G.iface.ifindex)
-			return true;
+	if (strcmp(cmd, "add") == 0) {
+		bool onlink = false;
+		uint32_t valid = UINT32_MAX, preferred = UINT32_MAX;
 
-		if (!G.iface.ok)
-			return true;
+		if (flag && strcmp(flag, "onlink") == 0) {
+			onlink = true;
+		}
+		else if (flag && !lifetimes) {
+			/* Lifetimes without the onlink flag */
+			lifetimes = flag;
+		}
+		else if (flag) {
+			return "error: invalid prefix flag";
+		}
 
-		break;
+		if (lifetimes && !parse_lifetimes(lifetimes, &valid, &preferred))
+			return "error: invalid prefix lifetimes";
 
-	case RTM_DELLINK:
-		if (G.iface.ok && (unsigned)msg->ifi_index == G.iface.ifindex)
-			return true;
-	}
+		struct prefix *entry;
 
-	return false;
-}
+		if (i >= 0) {
+			entry = &conf->prefixes[i];
 
-static bool handle_rtnl_addr(uint16_t type, const struct ifaddrmsg *msg) {
-	switch (type) {
-	case RTM_NEWADDR:
-		if (!G.iface.ok && (unsigned)msg->ifa_index == G.iface.ifindex)
-			return true;
+			/* A learned prefix is kept when it disappears from the interface */
+			entry->source |= PREFIX_STATIC;
 
-		break;
+			/* New lifetimes are patched into the cached RA; they don't need an RA of their own */
+			uint64_t valid_until = expiry_time(valid), preferred_until = expiry_time(preferred);
+			const bool expiry_changed = (entry->valid_until != valid_until || entry->preferred_until != preferred_until);
 
-	case RTM_DELADDR:
-		if (G.iface.ok && (unsigned)msg->ifa_index == G.iface.ifindex)
-			return true;
-	}
+			entry->valid_until = valid_until;
+			entry->preferred_until = preferred_until;
 
-	return false;
-}
+			if (entry->onlink == onlink)
+				return expiry_changed ? "ok" : "unchanged";
 
-static bool handle_rtnl_msg(uint16_t type, const void *data) {
-	switch (type) {
-	case RTM_NEWLINK:
-	case RTM_DELLINK:
-	case RTM_SETLINK:
-		return handle_rtnl_link(type, data);
+			entry->onlink = onlink;
+			config_changed(iface);
+			return "ok";
+		}
 
-	case RTM_NEWADDR:
-	case RTM_DELADDR:
-		return handle_rtnl_addr(type, data);
+		entry = config_add_prefix(conf, &prefix, onlink, PREFIX_STATIC);
+		entry->valid_until = expiry_time(valid);
+		entry->preferred_until = expiry_time(preferred);
 
-	default:
-		return false;
+		unwithdraw(iface, false, &prefix);
 	}
-}
+	else if (strcmp(cmd, "del") == 0) {
+		if (i < 0)
+			return "unchanged";
 
-static void handle_rtnl(void) {
-	char buffer[4096];
+		/* A prefix that is still present on the interface stays advertised */
+		conf->prefixes[i].source &= ~PREFIX_STATIC;
+		if (conf->prefixes[i].source)
+			return "unchanged";
 
-	ssize_t len = recv(G.rtnl_sock, buffer, sizeof(buffer), 0);
-	if (len < 0) {
-		warn_errno("recv");
-		return;
+		remove_prefix(iface, i);
+	}
+	else {
+		return "error: unknown command";
 	}
 
-	const struct nlmsghdr *nh;
-	for (nh = (struct nlmsghdr *)buffer; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
-		switch (nh->nlmsg_type) {
-		case NLMSG_DONE:
-			return;
+	config_changed(iface);
+	return "ok";
+}
 
-		case NLMSG_ERROR:
-			exit_error("netlink error", 0);
+static const char * control_rdnss(struct iface *iface, const char *cmd, const char *arg) {
+	struct config *conf = &iface->conf;
+	struct in6_addr addr;
 
-		default:
-			if (handle_rtnl_msg(nh->nlmsg_type, NLMSG_DATA(nh))) {
-				update_interface();
-				return;
-			}
-		}
-	}
-}
+	if (!arg || inet_pton(AF_INET6, arg, &addr) != 1)
+		return "error: invalid RDNSS IP address";
 
-static void add_pktinfo(struct msghdr *msg) {
-	struct cmsghdr *cmsg = (struct cmsghdr*)((char*)msg->msg_control + msg->msg_controllen);
+	ssize_t i = find_rdnss(conf, &addr);
 
-	cmsg->cmsg_level = IPPROTO_IPV6;
-	cmsg->cmsg_type = IPV6_PKTINFO;
-	cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
+	if (strcmp(cmd, "add") == 0) {
+		if (i >= 0)
+			return "unchanged";
 
-	msg->msg_controllen += cmsg->cmsg_len;
+		config_add_rdnss(conf, &addr);
+		unwithdraw(iface, true, &addr);
+	}
+	else if (strcmp(cmd, "del") == 0) {
+		if (i < 0)
+			return "unchanged";
 
-	struct in6_pktinfo pktinfo = {
-		.ipi6_addr = G.iface.ifaddr,
-		.ipi6_ifindex = G.iface.ifindex,
-	};
+		withdraw(iface, true, &addr, false);
 
-	memcpy(CMSG_DATA(cmsg), &pktinfo, sizeof(pktinfo));
+		conf->n_rdnss--;
+		memmove(&conf->rdnss[i], &conf->rdnss[i+1], (conf->n_rdnss - i) * sizeof(conf->rdnss[0]));
+	}
+	else {
+		return "error: unknown command";
+	}
+
+	config_changed(iface);
+	return "ok";
 }
 
+static const char * control_default_lifetime(struct iface *iface, const char *arg) {
+	char *endptr;
+	unsigned long val;
 
-static void handle_solicit(void) {
-	struct sockaddr_in6 addr;
+	if (!arg)
+		return "error: invalid default lifetime";
 
-	uint8_t buffer[1500] __attribute__((aligned(8)));
-	struct iovec vec = { .iov_base = buffer, .iov_len = sizeof(buffer) };
+	val = strtoul(arg, &endptr, 0);
+	if (!*arg || *endptr || val > UINT16_MAX)
+		return "error: invalid default lifetime";
 
-	uint8_t cbuf[1024] __attribute__((aligned(8)));
+	if (iface->conf.adv_default_lifetime == val)
+		return "unchanged";
 
+	iface->conf.adv_default_lifetime = val;
+	iface->conf.adv_default_lifetime_set = true;
 
-	struct msghdr msg = {
-		.msg_name = &addr,
-		.msg_namelen = sizeof(addr),
-		.msg_iov = &vec,
-		.msg_iovlen = 1,
-		.msg_control = cbuf,
-		.msg_controllen = sizeof(cbuf),
-	};
+	config_changed(iface);
+	return "ok";
+}
+
+static void control_close(struct control_client *client) {
+	epoll_ctl(G.epoll_fd, EPOLL_CTL_DEL, client->watch.fd, NULL);
+	close(client->watch.fd);
+	client->watch.fd = -1;
+}
+
+static void control_reply(struct control_client *client, const char *data, size_t len) {
+	/* Replies are small; a client that doesn't read them is dropped rather than waited for */
+	ssize_t ret = send(client->watch.fd, data, len, MSG_DONTWAIT|MSG_NOSIGNAL);
+	if (ret < 0 || (size_t)ret < len)
+		control_close(client);
+}
 
-	ssize_t len = recvmsg(G.icmp_sock, &msg, 0);
-	if (len < (ssize_t)sizeof(struct nd_router_solicit)) {
-		if (len < 0)
-			warn_errno("recvmsg");
+static void control_stats(struct control_client *client) {
+	char *data = NULL;
+	size_t len = 0;
 
+	FILE *f = open_memstream(&data, &len);
+	if (!f) {
+		control_reply(client, "error: out of memory\n", 21);
 		return;
 	}
 
-	struct cmsghdr *cmsg;
-	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-		if (cmsg->cmsg_level != IPPROTO_IPV6)
-			continue;
+	print_stats(f);
+	fclose(f);
 
-		if (cmsg->cmsg_type != IPV6_HOPLIMIT)
-			continue;
+	control_reply(client, data, len);
+	free(data);
+}
 
-		if (*(int*)CMSG_DATA(cmsg) != 255)
-			return;
+/* Looks up an interface by the name it has been given on the command line */
+static struct iface * find_iface(const char *name) {
+	struct iface *iface;
 
-		break;
+	for_each_iface(iface) {
+		if (strcmp(iface->name, name) == 0)
+			return iface;
 	}
 
-	const struct nd_router_solicit *s = (struct nd_router_solicit *)buffer;
-	if (s->nd_rs_hdr.icmp6_type != ND_ROUTER_SOLICIT || s->nd_rs_hdr.icmp6_code != 0)
-		return;
-
-	const struct icmpv6_opt *opt = (struct icmpv6_opt *)(buffer + sizeof(struct nd_router_solicit)), *end = (struct icmpv6_opt *)(buffer+len);
+	return NULL;
+}
 
-	for (; opt < end; opt += opt->length) {
-		if (opt+1 < end)
-			return;
+/*
+  Handles a single command:
 
-		if (!opt->length)
-			return;
+    prefix add <interface> <prefix> [onlink] [<valid seconds>[,<preferred seconds>]]
+    prefix del <interface> <prefix>
+    rdnss add <interface> <address>
+    rdnss del <interface> <address>
+    default-lifetime <interface> <seconds>
+    stats
 
-		if (opt+opt->length < end)
+  Changes only affect the given interface.
+*/
+static void control_command(struct control_client *client, char *line) {
+	char *saveptr;
+	const char *words[6] = {};
+	size_t n = 0;
+
+	const char *word;
+	for (word = strtok_r(line, " \t\r", &saveptr); word; word = strtok_r(NULL, " \t\r", &saveptr)) {
+		if (n == sizeof(words)/sizeof(words[0])) {
+			control_reply(client, "error: too many arguments\n", 26);
 			return;
+		}
 
-		if (opt->type == ND_OPT_SOURCE_LINKADDR && IN6_IS_ADDR_UNSPECIFIED(&addr.sin6_addr))
-			return;
+		words[n++] = word;
 	}
 
-	if (opt != end)
+	if (!n)
+		return;
+
+	if (strcmp(words[0], "stats") == 0) {
+		control_stats(client);
 		return;
+	}
+
+	const char *result;
+	bool lifetime = strcmp(words[0], "default-lifetime") == 0;
+	struct iface *iface = NULL;
+
+	const char *ifname = lifetime ? words[1] : words[2];
+	if (ifname)
+		iface = find_iface(ifname);
+
+	if (strcmp(words[0], "prefix") != 0 && strcmp(words[0], "rdnss") != 0 && !lifetime)
+		result = "error: unknown command";
+	else if (!words[1] || !ifname)
+		result = "error: missing arguments";
+	else if (!iface)
+		result = "error: unknown interface";
+	else if (lifetime)
+		result = control_default_lifetime(iface, words[2]);
+	else if (strcmp(words[0], "prefix") == 0)
+		result = control_prefix(iface, words[1], words[3], words[4], words[5]);
+	else
+		result = control_rdnss(iface, words[1], words[3]);
 
-	schedule_advert(true);
+	char reply[64];
+	int len = snprintf(reply, sizeof(reply), "%s\n", result);
+	control_reply(client, reply, len);
 }
 
-static void send_advert(void) {
-	if (!G.iface.ok)
+static void handle_control_client(struct watch *watch) {
+	struct control_client *client = container_of(watch, struct control_client, watch);
+
+	if (watch->fd < 0)
 		return;
 
-	struct nd_router_advert advert = {
-		.nd_ra_hdr = {
-			.icmp6_type = ND_ROUTER_ADVERT,
-			.icmp6_dataun.icmp6_un_data8 = {AdvCurHopLimit, 0 /* Flags */, (G.adv_default_lifetime>>8) & 0xff, G.adv_default_lifetime & 0xff },
-		},
-	};
+	ssize_t len = recv(watch->fd, client->buffer + client->len, sizeof(client->buffer) - client->len, MSG_DONTWAIT);
+	if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
 
-	struct icmpv6_opt lladdr = {ND_OPT_SOURCE_LINKADDR, 1, {}};
-	memcpy(lladdr.data, G.iface.mac, sizeof(G.iface.mac));
+	if (len <= 0) {
+		control_close(client);
+		return;
+	}
 
-	struct nd_opt_prefix_info prefixes[G.n_prefixes];
+	client->len += len;
 
-	size_t i;
-	for (i = 0; i < G.n_prefixes; i++) {
-		uint8_t flags = ND_OPT_PI_FLAG_AUTO;
-
-		if (G.prefixes_onlink[i])
-			flags |= ND_OPT_PI_FLAG_ONLINK;
-
-		prefixes[i] = (struct nd_opt_prefix_info){
-			.nd_opt_pi_type = ND_OPT_PREFIX_INFORMATION,
-			.nd_opt_pi_len = 4,
-			.nd_opt_pi_prefix_len = 64,
-			.nd_opt_pi_flags_reserved = flags,
-			.nd_opt_pi_valid_time = htonl(AdvValidLifetime),
-			.nd_opt_pi_preferred_time = htonl(AdvPreferredLifetime),
-			.nd_opt_pi_prefix = G.prefixes[i],
-		};
+	char *line = client->buffer, *nl;
+	while (watch->fd >= 0 && (nl = memchr(line, '\n', client->buffer + client->len - line))) {
+		*nl = 0;
+		control_command(client, line);
+		line = nl + 1;
 	}
 
-	struct nd_opt_rdnss rdnss = {};
-	uint8_t rdnss_ips[G.n_rdnss][16];
+	if (watch->fd < 0)
+		return;
 
-	if (G.n_rdnss > 0) {
-		rdnss.nd_opt_rdnss_type = 25;
-		rdnss.nd_opt_rdnss_len = 1 + 2 * G.n_rdnss;
-		rdnss.nd_opt_rdnss_lifetime = htonl(AdvRDNSSLifetime);
+	client->len -= line - client->buffer;
+	memmove(client->buffer, line, client->len);
 
-		for (i = 0; i < G.n_rdnss; i++)
-			memcpy(rdnss_ips[i], G.rdnss[i].s6_addr, 16);
+	if (client->len == sizeof(client->buffer)) {
+		control_reply(client, "error: line too long\n", 21);
+		if (watch->fd >= 0)
+			control_close(client);
 	}
+}
 
-	struct iovec vec[5] = {
-		{ .iov_base = &advert, .iov_len = sizeof(advert) },
-		{ .iov_base = &lladdr, .iov_len = sizeof(lladdr) },
-		{ .iov_base = prefixes, .iov_len = sizeof(prefixes) },
-		{ .iov_base = &rdnss, .iov_len = sizeof(rdnss) },
-		{ .iov_base = rdnss_ips, .iov_len = sizeof(rdnss_ips) }
-	};
+static void handle_control(struct watch *watch) {
+	size_t i;
 
-	struct sockaddr_in6 addr = {
-		.sin6_family = AF_INET6,
-		.sin6_addr = {
-			.s6_addr = {
-				/* all-nodes address */
-				0xff, 0x02, 0x00, 0x00,
-				0x00, 0x00, 0x00, 0x00,
-				0x00, 0x00, 0x00, 0x00,
-				0x00, 0x00, 0x00, 0x01,
-			}
-		},
-		.sin6_scope_id = G.iface.ifindex,
-	};
+	while (true) {
+		int fd = accept4(watch->fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				warn_errno("accept");
 
-	uint8_t cbuf[1024] __attribute__((aligned(8))) = {};
+			return;
+		}
 
-	struct msghdr msg = {
-		.msg_name = &addr,
-		.msg_namelen = sizeof(addr),
-		.msg_iov = vec,
-		.msg_iovlen = G.n_rdnss > 0 ? 5 : 3,
-		.msg_control = cbuf,
-		.msg_controllen = 0,
-		.msg_flags = 0,
-	};
+		for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+			if (control_clients[i].watch.fd < 0)
+				break;
+		}
 
-	add_pktinfo(&msg);
+		if (i == CONTROL_MAX_CLIENTS) {
+			close(fd);
+			continue;
+		}
 
-	if (sendmsg(G.icmp_sock, &msg, 0) < 0) {
-		G.iface.ok = false;
-		return;
+		struct control_client *client = &control_clients[i];
+		client->len = 0;
+		watch_add(&client->watch, fd, handle_control_client);
 	}
-
-	G.next_advert_earliest = G.time;
-	timespec_add(&G.next_advert_earliest, MIN_DELAY_BETWEEN_RAS);
-
-	schedule_advert(false);
 }
 
-
-static void usage(void) {
-	fprintf(stderr, "Usage: uradvd [-h] -i <interface> -a/-p <prefix> [ -a/-p <prefix> ... ] [ --default-lifetime <seconds> ] [ --rdnss <ip> ... ]\n");
+static void cleanup_control(void) {
+	unlink(G.control_path);
 }
 
-static void add_rdnss(const char *ip) {
-	if (G.n_rdnss == MAX_RDNSS) {
-		fprintf(stderr, "uradvd: error: maximum number of RDNSS IPs is %i.\n", MAX_RDNSS);
-		exit(1);
-	}
+static void init_control(void) {
+	size_t i;
 
-	if (inet_pton(AF_INET6, ip, &G.rdnss[G.n_rdnss]) != 1) {
-		fprintf(stderr, "uradvd: error: invalid RDNSS IP address %s.\n", ip);
-		exit(1);
-	}
+	if (!G.control_path)
+		return;
 
-	G.n_rdnss++;
-}
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++)
+		control_clients[i].watch.fd = -1;
 
-static void add_prefix(const char *prefix, bool adv_onlink) {
-	if (G.n_prefixes == MAX_PREFIXES) {
-		fprintf(stderr, "uradvd: error: maximum number of prefixes is %i.\n", MAX_PREFIXES);
-		exit(1);
-	}
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	if (strlen(G.control_path) >= sizeof(sun.sun_path))
+		exit_error("control socket path too long\n", 0);
 
-	const size_t len = strlen(prefix)+1;
-	char prefix2[len];
-	memcpy(prefix2, prefix, len);
+	strcpy(sun.sun_path, G.control_path);
 
-	char *slash = strchr(prefix2, '/');
-	if (slash) {
-		*slash = 0;
-		if (strcmp(slash+1, "64") != 0)
-			goto error;
-	}
+	int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		exit_errno("can't open control socket");
 
-	if (inet_pton(AF_INET6, prefix2, &G.prefixes[G.n_prefixes]) != 1)
-		goto error;
+	unlink(G.control_path);
 
-	static const uint8_t zero[8] = {};
-	if (memcmp(G.prefixes[G.n_prefixes].s6_addr + 8, zero, 8) != 0)
-		goto error;
+	/* Only the owner may connect */
+	mode_t mask = umask(077);
+	int ret = bind(fd, (struct sockaddr *)&sun, sizeof(sun));
+	umask(mask);
 
-	G.prefixes_onlink[G.n_prefixes] = adv_onlink;
+	if (ret < 0)
+		exit_errno("can't bind control socket");
 
-	G.n_prefixes++;
-	return;
+	if (listen(fd, CONTROL_MAX_CLIENTS) < 0)
+		exit_errno("can't listen on control socket");
 
-error:
-	fprintf(stderr, "uradvd: error: invalid prefix %s (only prefixes of length 64 are supported).\n", prefix);
-	exit(1);
+	atexit(cleanup_control);
+
+	watch_add(&G.control_watch, fd, handle_control);
 }
 
 static void parse_cmdline(int argc, char *argv[]) {
+	struct config *conf = &G.defaults;
+	struct iface *iface;
 	int c;
 	char *endptr;
 	unsigned long val;
@@ -634,6 +4664,21 @@ static void parse_cmdline(int argc, char *argv[]) {
 	{
 		{"default-lifetime", required_argument, 0, 0},
 		{"rdnss", required_argument, 0, 1},
+		{"kernel-filter", no_argument, 0, 2},
+		{"refresh-delay", required_argument, 0, 3},
+		{"netlink-rcvbuf", required_argument, 0, 4},
+		{"unicast-ra", required_argument, 0, 5},
+		{"rs-limit", required_argument, 0, 6},
+		{"source-rs-limit", required_argument, 0, 7},
+		{"ra-interval", required_argument, 0, 8},
+		{"suppress", no_argument, 0, 9},
+		{"initial-ras", required_argument, 0, 10},
+		{"final-ras", required_argument, 0, 11},
+		{"control", required_argument, 0, 12},
+		{"learn-prefixes", optional_argument, 0, 13},
+		{"log", required_argument, 0, 14},
+		{"ra-delay", required_argument, 0, 15},
+		{"rs-storm", required_argument, 0, 16},
 		{0, 0, 0, 0}
 	};
 
@@ -647,28 +4692,180 @@ static void parse_cmdline(int argc, char *argv[]) {
 			if (!*optarg || *endptr || val > UINT16_MAX)
 				exit_error("invalid default lifetime\n", 0);
 
-			G.adv_default_lifetime = val;
+			conf->adv_default_lifetime = val;
+			conf->adv_default_lifetime_set = true;
 
 			break;
 
 		case 1: // --rdnss
-			add_rdnss(optarg);
+			add_rdnss(conf, optarg);
 			break;
 
-		case 'i':
-			if (G.ifname)
-				exit_error("multiple interfaces are not supported.\n", 0);
+		case 2: // --kernel-filter
+			G.kernel_filter = true;
+			break;
+
+		case 3: // --refresh-delay
+			val = strtoul(optarg, &endptr, 0);
+
+			if (!*optarg || *endptr || val > MIN_DELAY_BETWEEN_RAS)
+				exit_error("invalid refresh delay\n", 0);
+
+			G.refresh_delay = val;
+
+			break;
+
+		case 4: // --netlink-rcvbuf
+			val = strtoul(optarg, &endptr, 0);
+
+			if (!*optarg || *endptr || !val || val > INT_MAX/2)
+				exit_error("invalid netlink receive buffer size\n", 0);
+
+			G.rtnl_rcvbuf = val;
+
+			break;
+
+		case 5: // --unicast-ra
+			val = strtoul(optarg, &endptr, 0);
+
+			if (!*optarg || *endptr || val > MAX_UNICAST_PENDING)
+				exit_error("invalid maximum number of unicast RA solicitors\n", 0);
+
+			G.unicast_max = val;
+
+			break;
+
+		case 6: // --rs-limit
+			parse_rate_limit(&G.rs_limit_iface, optarg);
+			break;
+
+		case 7: // --source-rs-limit
+			parse_rate_limit(&G.rs_limit_source, optarg);
+			break;
+
+		case 8: // --ra-interval
+			parse_ra_interval(conf, optarg);
+			break;
+
+		case 9: // --suppress
+			G.suppress = true;
+			break;
+
+		case 10: // --initial-ras
+			val = strtoul(optarg, &endptr, 0);
+
+			if (endptr == optarg || val > UINT16_MAX)
+				exit_error("invalid initial RA count\n", 0);
+
+			G.initial_adverts = val;
+
+			if (*endptr == ',') {
+				const char *interval = endptr+1;
+				val = strtoul(interval, &endptr, 0);
+
+				if (endptr == interval || val < MIN_DELAY_BETWEEN_RAS || val > MAX_RA_INTERVAL*1000)
+					exit_error("invalid initial RA interval\n", 0);
 
-			G.ifname = optarg;
+				G.initial_interval = val;
+			}
+
+			if (*endptr)
+				exit_error("invalid initial RA count\n", 0);
+
+			break;
+
+		case 11: // --final-ras
+			val = strtoul(optarg, &endptr, 0);
+
+			if (!*optarg || *endptr || val > MAX_FINAL_RTR_ADVERTISEMENTS)
+				exit_error("invalid final RA count\n", 0);
+
+			G.final_adverts = val;
+
+			break;
+
+		case 12: // --control
+			G.control_path = optarg;
+			break;
+
+		case 13: // --learn-prefixes
+			if (!optarg)
+				conf->learn_prefixes = LEARN_AUTO;
+			else if (strcmp(optarg, "onlink") == 0)
+				conf->learn_prefixes = LEARN_ONLINK;
+			else
+				exit_error("invalid prefix learning mode\n", 0);
+
+			break;
+
+		case 14: // --log
+			if (strcmp(optarg, "stderr") == 0)
+				G.log_format = LOG_FORMAT_PLAIN;
+			else if (strcmp(optarg, "json") == 0)
+				G.log_format = LOG_FORMAT_JSON;
+			else if (strcmp(optarg, "syslog") == 0)
+				G.log_format = LOG_FORMAT_SYSLOG;
+			else
+				exit_error("invalid log output\n", 0);
+
+			break;
+
+		case 15: // --ra-delay
+			val = strtoul(optarg, &endptr, 0);
+
+			if (endptr == optarg || val > MAX_RA_DELAY_TIME)
+				exit_error("invalid RA delay\n", 0);
+
+			G.ra_delay_single = G.ra_delay = val;
+
+			if (*endptr == ',') {
+				const char *delay = endptr+1;
+				val = strtoul(delay, &endptr, 0);
+
+				if (endptr == delay || val > MAX_RA_DELAY_TIME)
+					exit_error("invalid RA delay\n", 0);
+
+				G.ra_delay = val;
+			}
+
+			if (*endptr)
+				exit_error("invalid RA delay\n", 0);
+
+			break;
+
+		case 16: // --rs-storm
+			val = strtoul(optarg, &endptr, 0);
+
+			if (endptr == optarg || *endptr != ',' || val > UINT32_MAX)
+				exit_error("invalid solicitation storm settings\n", 0);
 
+			G.storm_threshold = val;
+
+			if (*endptr == ',') {
+				const char *delay = endptr+1;
+				val = strtoul(delay, &endptr, 0);
+
+				if (endptr == delay || val > MIN_DELAY_BETWEEN_RAS)
+					exit_error("invalid solicitation storm settings\n", 0);
+
+				G.ra_delay_storm = val;
+			}
+
+			if (*endptr)
+				exit_error("invalid solicitation storm settings\n", 0);
+
+			break;
+
+		case 'i':
+			conf = &add_iface(optarg)->conf;
 			break;
 
 		case 'a':
-			add_prefix(optarg, false);
+			add_prefix(conf, optarg, false);
 			break;
 
 		case 'p':
-			add_prefix(optarg, true);
+			add_prefix(conf, optarg, true);
 			break;
 
 		case 'h':
@@ -680,50 +4877,100 @@ static void parse_cmdline(int argc, char *argv[]) {
 			exit(1);
 		}
 	}
+
+	if (!G.ifaces)
+		exit_error("interface and prefix arguments are required.\n", 0);
+
+	if (G.storm_threshold && G.ra_delay_storm < G.ra_delay)
+		exit_error("the solicitation storm delay must not be shorter than the RA delay\n", 0);
+
+	for_each_iface(iface) {
+		merge_defaults(iface);
+
+		if (!iface->conf.n_prefixes && !iface->conf.learn_prefixes)
+			exit_error("interface and prefix arguments are required.\n", 0);
+	}
 }
 
+#endif
+
 int main(int argc, char *argv[]) {
-	parse_cmdline(argc, argv);
+	struct iface *iface;
+	struct netns *ns;
 
-	if (!G.ifname || !G.n_prefixes)
-		exit_error("interface and prefix arguments are required.\n", 0);
+	update_time();
+	G.start_time = G.now;
+
+	parse_cmdline(argc, argv);
 
+#ifndef URADVD_STATIC
+	init_log();
+#endif
 	init_random();
-	init_icmp();
-	init_rtnl();
+#ifndef URADVD_STATIC
+	init_sources();
+	init_event_loop();
+#endif
+	init_signals();
+	init_netns();
+
+	timer_init(&G.refresh_timer, refresh_dirty_interfaces);
+
+	/* The first RA of every interface is sent as soon as its state is known,
+	   before the next interface is looked up */
+	for_each_iface(iface) {
+		update_time();
 
-	update_time();
-	G.next_advert = G.next_advert_earliest = G.time;
+		timer_init(&iface->advert_timer, send_advert);
+#ifndef URADVD_STATIC
+		timer_init(&iface->unicast_timer, send_unicast_adverts);
+#endif
+
+		iface->next_advert_earliest = G.now;
+		iface->ra_interval = iface->conf.max_ra_interval * 1000ull;
+		iface->last_advert = G.now;
+		start_interface(iface);
 
-	update_interface();
+		/* The queries have taken time, which first_ra_us must include */
+		update_time();
+		run_timers();
+	}
+
+#ifndef URADVD_STATIC
+	init_control();
+#endif
+
+	for (ns = G.netns; ns; ns = ns->next) {
+		watch_add(&ns->rtnl_watch, ns->rtnl_sock, handle_rtnl);
+		watch_add(&ns->icmp_watch, ns->icmp_sock, handle_icmp);
+	}
 
 	while (true) {
-		struct pollfd fds[2] = {
-			{ .fd = G.icmp_sock, .events = POLLIN },
-			{ .fd = G.rtnl_sock, .events = POLLIN },
-		};
+#ifdef URADVD_STATIC
+		handle_events();
+#else
+		struct epoll_event events[16];
+		int i;
 
-		int timeout = -1;
+		log_schedule();
+		timer_fd_update();
 
-		if (G.iface.ok) {
-			timeout = timespec_diff(&G.next_advert, &G.time);
+		int n = epoll_wait(G.epoll_fd, events, sizeof(events)/sizeof(events[0]), -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
 
-			if (timeout < 0)
-				timeout = 0;
+			exit_errno("epoll_wait");
 		}
 
-		int ret = poll(fds, 2, timeout);
-		if (ret < 0)
-			exit_errno("poll");
-
 		update_time();
 
-		if (fds[0].revents & POLLIN)
-			handle_solicit();
-		if (fds[1].revents & POLLIN)
-			handle_rtnl();
+		for (i = 0; i < n; i++) {
+			struct watch *watch = events[i].data.ptr;
+			watch->cb(watch);
+		}
+#endif
 
-		if (timespec_after(&G.time, &G.next_advert))
-			send_advert();
+		run_timers();
 	}
 }